@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "batch.hpp"
+#include "expression.hpp"
+
+namespace conftaal {
+
+namespace {
+
+// One value for every position.
+template<typename T>
+struct Broadcast {
+	T value;
+	T operator [] (std::size_t) const { return value; }
+};
+
+// A column, read as T.
+template<typename T, typename U>
+struct Converted {
+	U const * values;
+	T operator [] (std::size_t i) const { return T(values[i]); }
+};
+
+// The number of rows evaluated at once, small enough for the columns of the
+// values of all nodes to stay in the cache.
+constexpr std::size_t chunk_rows = 4096;
+
+using Positions = std::vector<std::uint32_t, UninitializedAllocator<std::uint32_t>>;
+
+template<typename R>
+constexpr NumericType type_of = std::is_same_v<R, double> ? NumericType::floating : NumericType::integer;
+
+}
+
+// The rows a node is evaluated for: all rows of a chunk, or some of them.
+// Its values are stored by their position in the selection, so a column only
+// holds the selected rows.
+struct BatchEvaluator::Selection {
+	std::size_t first; // The first row of the chunk.
+	std::size_t size;
+	bool all;
+	Positions rows; // Only if !all.
+
+	std::size_t row(std::size_t i) const { return all ? first + i : rows[i]; }
+};
+
+// The values of a node for the selected rows: either one value for all of
+// them, or a column of its own, or part of an input column when all rows of
+// a chunk are selected.
+struct BatchEvaluator::Values {
+	NumericType type = NumericType::integer;
+	bool scalar = false;
+	std::int64_t integer = 0; // If scalar.
+	double floating = 0; // If scalar.
+	std::int64_t const * integers = nullptr; // If !scalar, in 'owned' or an input.
+	double const * floats = nullptr; // If !scalar, in 'owned' or an input.
+	Column owned;
+
+	static Values borrow(Column const & c, std::size_t first) {
+		Values v;
+		v.type = c.type;
+		if (c.type == NumericType::integer) {
+			v.integers = c.integers.data() + first;
+		} else {
+			v.floats = c.floats.data() + first;
+		}
+		return v;
+	}
+
+	static Values constant(std::int64_t value) {
+		Values v;
+		v.scalar = true;
+		v.integer = value;
+		return v;
+	}
+
+	static Values constant(double value) {
+		Values v;
+		v.type = NumericType::floating;
+		v.scalar = true;
+		v.floating = value;
+		return v;
+	}
+
+	template<typename R>
+	static Values make_column(std::size_t n) {
+		Values v;
+		v.type = v.owned.type = type_of<R>;
+		if constexpr (std::is_same_v<R, double>) {
+			v.owned.floats.resize(n);
+			v.floats = v.owned.floats.data();
+		} else {
+			v.owned.integers.resize(n);
+			v.integers = v.owned.integers.data();
+		}
+		return v;
+	}
+
+	template<typename R>
+	static R * data(Values & v) {
+		if constexpr (std::is_same_v<R, double>) {
+			return v.owned.floats.data();
+		} else {
+			return v.owned.integers.data();
+		}
+	}
+
+	template<typename T>
+	T get() const {
+		return type == NumericType::integer ? T(integer) : T(floating);
+	}
+
+	// Calls f with something that gives the value at each position as a T.
+	template<typename T, typename F>
+	void visit(F && f) const {
+		if (scalar) {
+			f(Broadcast<T>{get<T>()});
+		} else if (type == NumericType::integer) {
+			f(Converted<T, std::int64_t>{integers});
+		} else {
+			f(Converted<T, double>{floats});
+		}
+	}
+
+	// Applies f to the value at each position, read as T, giving values of
+	// type R.
+	template<typename R, typename T, typename F>
+	Values map(std::size_t n, F f) const {
+		if (scalar) return constant(R(f(get<T>())));
+		auto result = make_column<R>(n);
+		auto out = data<R>(result);
+		visit<T>([&] (auto a) {
+			for (std::size_t i = 0; i < n; ++i) out[i] = f(a[i]);
+		});
+		return result;
+	}
+
+	// Like map(), for the values of a and b at each position.
+	template<typename R, typename T, typename F>
+	static Values zip(std::size_t n, Values const & a, Values const & b, F f) {
+		if (a.scalar && b.scalar) return constant(R(f(a.get<T>(), b.get<T>())));
+		auto result = make_column<R>(n);
+		auto out = data<R>(result);
+		a.visit<T>([&] (auto x) {
+			b.visit<T>([&] (auto y) {
+				for (std::size_t i = 0; i < n; ++i) out[i] = f(x[i], y[i]);
+			});
+		});
+		return result;
+	}
+
+	bool truthy(std::size_t i) const {
+		if (scalar) return type == NumericType::integer ? integer != 0 : floating != 0;
+		return type == NumericType::integer ? integers[i] != 0 : floats[i] != 0;
+	}
+
+	// Stores the positions at which the truthiness of the column is 'truth'
+	// in 'out', returning how many there are. Without branching, since that
+	// is unpredictable.
+	std::size_t find(bool truth, std::uint32_t * out, std::size_t n) const {
+		std::size_t k = 0;
+		auto scan = [&] (auto values) {
+			for (std::size_t i = 0; i < n; ++i) {
+				out[k] = i;
+				k += (values[i] != 0) == truth;
+			}
+		};
+		if (type == NumericType::integer) {
+			scan(integers);
+		} else {
+			scan(floats);
+		}
+		return k;
+	}
+
+	// 1 for the positions with a non-zero value, 0 for the others.
+	Values truth(std::size_t n) const {
+		auto is_true = [] (auto a) { return std::int64_t(a != 0); };
+		if (type == NumericType::integer) return map<std::int64_t, std::int64_t>(n, is_true);
+		return map<std::int64_t, double>(n, is_true);
+	}
+
+	// Marks the rows for which the (integer) value is bad as failed. This
+	// is a separate pass after computing the results, so the loops doing
+	// that don't have to track failures, and usually finds nothing.
+	template<typename F>
+	void fail_where(Selection const & sel, std::vector<std::uint8_t> & failed, F bad) const {
+		if (scalar) {
+			if (bad(integer)) for (std::size_t i = 0; i < sel.size; ++i) failed[sel.row(i)] = 1;
+			return;
+		}
+		auto v = integers;
+		bool any = false;
+		for (std::size_t i = 0; i < sel.size; ++i) any |= bad(v[i]);
+		if (!any) return;
+		for (std::size_t i = 0; i < sel.size; ++i) {
+			if (bad(v[i])) failed[sel.row(i)] = 1;
+		}
+	}
+};
+
+BatchEvaluator::BatchEvaluator(Expression const & expr, Inputs const & inputs)
+	: nodes_(compile_numeric(expr, inputs)) {}
+
+Column BatchEvaluator::evaluate(std::vector<Column const *> const & columns, std::vector<std::uint8_t> * failed) const {
+	std::size_t n_rows = columns.empty() ? 1 : columns[0]->size();
+	std::vector<std::uint8_t> failed_rows;
+	std::vector<std::uint8_t> & f = failed ? *failed : failed_rows;
+	f.assign(n_rows, 0);
+	Column result;
+	result.type = result_type();
+	if (result.type == NumericType::integer) {
+		result.integers.resize(n_rows);
+	} else {
+		result.floats.resize(n_rows);
+	}
+	for (std::size_t first = 0; first < n_rows; first += chunk_rows) {
+		std::size_t n = std::min(chunk_rows, n_rows - first);
+		auto values = evaluate(nodes_.size() - 1, columns, Selection{first, n, true, {}}, f);
+		if (result.type == NumericType::integer) {
+			auto out = result.integers.data() + first;
+			if (values.scalar) {
+				std::fill(out, out + n, values.integer);
+			} else {
+				std::copy(values.integers, values.integers + n, out);
+			}
+		} else {
+			auto out = result.floats.data() + first;
+			if (values.scalar) {
+				std::fill(out, out + n, values.floating);
+			} else {
+				std::copy(values.floats, values.floats + n, out);
+			}
+		}
+	}
+	return result;
+}
+
+BatchEvaluator::Values BatchEvaluator::evaluate(
+	std::size_t index,
+	std::vector<Column const *> const & columns,
+	Selection const & sel,
+	std::vector<std::uint8_t> & failed
+) const {
+	using Int = std::int64_t;
+
+	auto const & node = nodes_[index];
+	std::size_t const n = sel.size;
+
+	switch (node.kind) {
+		case Node::Kind::input: {
+			auto const & input = *columns[node.rhs];
+			if (sel.all) return Values::borrow(input, sel.first);
+			if (input.type == NumericType::integer) {
+				auto result = Values::make_column<Int>(n);
+				auto out = Values::data<Int>(result);
+				for (std::size_t i = 0; i < n; ++i) out[i] = input.integers[sel.rows[i]];
+				return result;
+			} else {
+				auto result = Values::make_column<double>(n);
+				auto out = Values::data<double>(result);
+				for (std::size_t i = 0; i < n; ++i) out[i] = input.floats[sel.rows[i]];
+				return result;
+			}
+		}
+
+		case Node::Kind::constant:
+			if (node.type == NumericType::integer) return Values::constant(node.integer);
+			return Values::constant(node.floating);
+
+		case Node::Kind::unary: {
+			auto operand = evaluate(node.rhs, columns, sel, failed);
+			if (node.op == Operator::logical_not) {
+				auto is_false = [] (auto a) { return Int(a == 0); };
+				if (operand.type == NumericType::integer) return operand.map<Int, Int>(n, is_false);
+				return operand.map<Int, double>(n, is_false);
+			}
+			if (operand.type == NumericType::integer) {
+				switch (node.op) {
+					case Operator::unary_minus: return operand.map<Int, Int>(n, [] (Int a) { return wrapping_sub(0, a); });
+					case Operator::complement: return operand.map<Int, Int>(n, [] (Int a) { return ~a; });
+					default: return operand;
+				}
+			} else {
+				switch (node.op) {
+					case Operator::unary_minus: return operand.map<double, double>(n, [] (double a) { return -a; });
+					default: return operand;
+				}
+			}
+		}
+
+		case Node::Kind::binary:
+			break;
+	}
+
+	if (node.op == Operator::logical_and || node.op == Operator::logical_or) {
+		bool is_and = node.op == Operator::logical_and;
+		auto lhs = evaluate(node.lhs, columns, sel, failed);
+		if (lhs.scalar) {
+			if (lhs.truthy(0) != is_and) return Values::constant(Int(!is_and));
+			return evaluate(node.rhs, columns, sel, failed).truth(n);
+		}
+		// The positions of the rows for which the left hand side does not
+		// decide the result already.
+		Positions rest(n);
+		rest.resize(lhs.find(is_and, rest.data(), n));
+		if (rest.empty()) return Values::constant(Int(!is_and));
+		if (rest.size() == n) return evaluate(node.rhs, columns, sel, failed).truth(n);
+		Selection rest_sel{sel.first, rest.size(), false, {}};
+		if (sel.all) {
+			rest_sel.rows.resize(rest.size());
+			for (std::size_t k = 0; k < rest.size(); ++k) rest_sel.rows[k] = sel.first + rest[k];
+		} else {
+			rest_sel.rows.resize(rest.size());
+			for (std::size_t k = 0; k < rest.size(); ++k) rest_sel.rows[k] = sel.rows[rest[k]];
+		}
+		auto rhs = evaluate(node.rhs, columns, rest_sel, failed);
+		auto result = Values::make_column<Int>(n);
+		auto out = Values::data<Int>(result);
+		std::fill(out, out + n, !is_and);
+		if (rhs.scalar) {
+			for (auto i : rest) out[i] = rhs.truthy(0);
+		} else if (rhs.type == NumericType::integer) {
+			auto r = rhs.integers;
+			for (std::size_t k = 0; k < rest.size(); ++k) out[rest[k]] = r[k] != 0;
+		} else {
+			auto r = rhs.floats;
+			for (std::size_t k = 0; k < rest.size(); ++k) out[rest[k]] = r[k] != 0;
+		}
+		return result;
+	}
+
+	auto lhs = evaluate(node.lhs, columns, sel, failed);
+	auto rhs = evaluate(node.rhs, columns, sel, failed);
+
+	if (is_comparison(node.op)) {
+		auto compare = [&] (auto operand) {
+			using T = decltype(operand);
+			switch (node.op) {
+				case Operator::equal:            return Values::zip<Int, T>(n, lhs, rhs, [] (T a, T b) { return a == b; });
+				case Operator::inequal:          return Values::zip<Int, T>(n, lhs, rhs, [] (T a, T b) { return a != b; });
+				case Operator::greater:          return Values::zip<Int, T>(n, lhs, rhs, [] (T a, T b) { return a > b; });
+				case Operator::less:             return Values::zip<Int, T>(n, lhs, rhs, [] (T a, T b) { return a < b; });
+				case Operator::greater_or_equal: return Values::zip<Int, T>(n, lhs, rhs, [] (T a, T b) { return a >= b; });
+				default:                         return Values::zip<Int, T>(n, lhs, rhs, [] (T a, T b) { return a <= b; });
+			}
+		};
+		if (lhs.type == NumericType::integer && rhs.type == NumericType::integer) return compare(Int());
+		return compare(double());
+	}
+
+	if (node.type == NumericType::integer) {
+		// Failures are found by fail_where(), and the results for failed rows
+		// don't matter.
+		switch (node.op) {
+			case Operator::plus:    return Values::zip<Int, Int>(n, lhs, rhs, [] (Int a, Int b) { return wrapping_add(a, b); });
+			case Operator::minus:   return Values::zip<Int, Int>(n, lhs, rhs, [] (Int a, Int b) { return wrapping_sub(a, b); });
+			case Operator::times:   return Values::zip<Int, Int>(n, lhs, rhs, [] (Int a, Int b) { return wrapping_mul(a, b); });
+			case Operator::bit_and: return Values::zip<Int, Int>(n, lhs, rhs, [] (Int a, Int b) { return a & b; });
+			case Operator::bit_or:  return Values::zip<Int, Int>(n, lhs, rhs, [] (Int a, Int b) { return a | b; });
+			case Operator::bit_xor: return Values::zip<Int, Int>(n, lhs, rhs, [] (Int a, Int b) { return a ^ b; });
+			case Operator::divide:
+				rhs.fail_where(sel, failed, [] (Int b) { return b == 0; });
+				return Values::zip<Int, Int>(n, lhs, rhs, [=] (Int a, Int b) { std::uint8_t ignored; return integer_divide(a, b, ignored); });
+			case Operator::modulo:
+				rhs.fail_where(sel, failed, [] (Int b) { return b == 0; });
+				return Values::zip<Int, Int>(n, lhs, rhs, [=] (Int a, Int b) { std::uint8_t ignored; return integer_modulo(a, b, ignored); });
+			case Operator::power:
+				rhs.fail_where(sel, failed, [] (Int b) { return b < 0; });
+				return Values::zip<Int, Int>(n, lhs, rhs, [=] (Int a, Int b) { std::uint8_t ignored; return integer_power(a, b, ignored); });
+			default: {
+				auto op = node.op;
+				rhs.fail_where(sel, failed, [] (Int b) { return std::uint64_t(b) > 63; });
+				return Values::zip<Int, Int>(n, lhs, rhs, [=] (Int a, Int b) { std::uint8_t ignored; return shift(op, a, b, ignored); });
+			}
+		}
+	} else {
+		switch (node.op) {
+			case Operator::plus:   return Values::zip<double, double>(n, lhs, rhs, [] (double a, double b) { return a + b; });
+			case Operator::minus:  return Values::zip<double, double>(n, lhs, rhs, [] (double a, double b) { return a - b; });
+			case Operator::times:  return Values::zip<double, double>(n, lhs, rhs, [] (double a, double b) { return a * b; });
+			case Operator::divide: return Values::zip<double, double>(n, lhs, rhs, [] (double a, double b) { return a / b; });
+			case Operator::modulo: return Values::zip<double, double>(n, lhs, rhs, [] (double a, double b) { return std::fmod(a, b); });
+			default:               return Values::zip<double, double>(n, lhs, rhs, [] (double a, double b) { return std::pow(a, b); });
+		}
+	}
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+#include "numeric.hpp"
+
+namespace conftaal {
+
+// Leaves the elements a vector is resized with uninitialized, so columns
+// aren't filled with zeros only to be overwritten.
+template<typename T>
+struct UninitializedAllocator : std::allocator<T> {
+	template<typename U>
+	struct rebind { using other = UninitializedAllocator<U>; };
+
+	UninitializedAllocator() = default;
+	template<typename U>
+	UninitializedAllocator(UninitializedAllocator<U> const &) noexcept {}
+
+	template<typename U>
+	void construct(U * p) noexcept { ::new (static_cast<void *>(p)) U; }
+	template<typename U, typename... Args>
+	void construct(U * p, Args &&... args) { ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...); }
+};
+
+// A column of numbers, one per row, all of the same type.
+struct Column {
+	NumericType type = NumericType::integer;
+	std::vector<std::int64_t, UninitializedAllocator<std::int64_t>> integers;
+	std::vector<double, UninitializedAllocator<double>> floats;
+
+	std::size_t size() const {
+		return type == NumericType::integer ? integers.size() : floats.size();
+	}
+};
+
+// Evaluates one numeric expression, like `a > b ** 3 && x != y', for many
+// rows of inputs at once, one operator at a time over the columns of a few
+// thousand rows at a time.
+//
+// See numeric.hpp for the semantics. `&&' and `||' only evaluate their
+// right hand side for the rows where that is needed, and only those rows
+// are stored in the columns for that side. Input columns are read in place,
+// and constants are not turned into columns.
+//
+// In a release build, conftaal-bench shows this to be about four times as
+// fast as walking the tree for every row for `a > b ** 3 && x != y', and
+// faster still for expressions without `&&' and `||'.
+class BatchEvaluator {
+public:
+	using Inputs = NumericInputs;
+
+	// Every identifier in the expression must be one of the named inputs.
+	// Throws an Error pointing at the first unsupported subexpression.
+	BatchEvaluator(Expression const & expr, Inputs const & inputs);
+
+	NumericType result_type() const { return nodes_.back().type; }
+
+	// The columns must be in the same order and of the same types as the
+	// inputs given to the constructor, and all have the same size.
+	//
+	// If 'failed' is given, it is resized to the number of rows, and set to
+	// 1 for the rows for which evaluation failed. The result for those rows
+	// is unspecified.
+	Column evaluate(std::vector<Column const *> const & columns, std::vector<std::uint8_t> * failed = nullptr) const;
+
+private:
+	using Node = NumericNode;
+
+	struct Selection;
+	struct Values;
+	Values evaluate(std::size_t node, std::vector<Column const *> const &, Selection const &, std::vector<std::uint8_t> &) const;
+
+	std::vector<Node> nodes_;
+};
+
+}
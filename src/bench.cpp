@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch.hpp"
+#include "error.hpp"
+#include "expression.hpp"
+#include "jit.hpp"
+#include "parse.hpp"
+#include "print_error.hpp"
+
+// Compares the ways to evaluate a numeric expression: walking the tree,
+// compiled code, and in batches.
+//
+// Every way is run once to warm up, and then a number of times, reporting
+// the fastest and the median run. Identifiers starting with `f' are
+// floating point inputs, all others are integer inputs.
+
+namespace conftaal {
+
+namespace {
+
+void collect_identifiers(Expression const & expr, std::vector<std::string_view> & names) {
+	if (auto e = dynamic_cast<IdentifierExpression const *>(&expr)) {
+		if (std::find(names.begin(), names.end(), e->identifier) == names.end()) names.push_back(e->identifier);
+	} else if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
+		if (e->lhs) collect_identifiers(*e->lhs, names);
+		collect_identifiers(*e->rhs, names);
+	}
+}
+
+// Returns the median time per row, or 0 if the runs were inconsistent.
+template<typename F>
+double measure(char const * name, std::size_t n_rows, std::size_t n_runs, F && f) {
+	auto checksum = f();
+	std::vector<double> times;
+	for (std::size_t run = 0; run < n_runs; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		if (f() != checksum) {
+			std::cout << name << ": inconsistent checksums" << std::endl;
+			return 0;
+		}
+		std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+		times.push_back(time.count() / n_rows);
+	}
+	std::sort(times.begin(), times.end());
+	std::cout << name << ": " << times.front() << " ns/row best, " << times[times.size() / 2]
+		<< " ns/row median of " << n_runs << " runs (checksum " << checksum << ")" << std::endl;
+	return times[times.size() / 2];
+}
+
+void bench(Expression const & expr, std::size_t n_rows, std::size_t n_runs) {
+	std::vector<std::string_view> names;
+	collect_identifiers(expr, names);
+	NumericInputs inputs;
+	std::vector<Column> columns(names.size());
+	// Row-major, for evaluating one row at a time.
+	std::vector<std::int64_t> rows(n_rows * names.size());
+	for (std::size_t k = 0; k < names.size(); ++k) {
+		auto type = names[k][0] == 'f' ? NumericType::floating : NumericType::integer;
+		inputs.emplace_back(names[k], type);
+		columns[k].type = type;
+		for (std::size_t i = 0; i < n_rows; ++i) {
+			auto v = std::int64_t((i * (k + 2) + k) % 1009) - 504;
+			if (type == NumericType::integer) {
+				columns[k].integers.push_back(v);
+				rows[i * names.size() + k] = v;
+			} else {
+				columns[k].floats.push_back(v * 0.25);
+				rows[i * names.size() + k] = to_bits(v * 0.25);
+			}
+		}
+	}
+
+	CompiledExpression compiled(expr, inputs);
+	BatchEvaluator evaluator(expr, inputs);
+
+	auto row_by_row = [&] (bool native) {
+		std::int64_t sum = 0;
+		for (std::size_t i = 0; i < n_rows; ++i) {
+			std::uint8_t failed = 0;
+			auto row = rows.data() + i * names.size();
+			auto v = native ? compiled.evaluate(row, failed) : compiled.interpret(row, failed);
+			if (!failed) sum += v;
+		}
+		return sum;
+	};
+
+	auto tree_walking = measure("tree walking", n_rows, n_runs, [&] { return row_by_row(false); });
+	if (compiled.is_native()) {
+		measure("compiled", n_rows, n_runs, [&] { return row_by_row(true); });
+	} else {
+		std::cout << "compiled: not available on this system" << std::endl;
+	}
+	auto batch = measure("batch", n_rows, n_runs, [&] {
+		std::vector<Column const *> column_ptrs;
+		for (auto const & c : columns) column_ptrs.push_back(&c);
+		std::vector<std::uint8_t> failed;
+		auto result = evaluator.evaluate(column_ptrs, &failed);
+		std::int64_t sum = 0;
+		for (std::size_t i = 0; i < n_rows; ++i) {
+			if (!failed[i]) sum += result.type == NumericType::integer ? result.integers[i] : to_bits(result.floats[i]);
+		}
+		return sum;
+	});
+	if (batch > 0 && tree_walking > 0) {
+		std::cout << "batch is " << tree_walking / batch << " times as fast as tree walking" << std::endl;
+	}
+}
+
+}
+
+}
+
+int main(int argc, char * * argv) {
+	if (argc < 2 || argc > 4) {
+		std::clog << "Usage: " << argv[0] << " expression [rows [runs]]" << std::endl;
+		return 1;
+	}
+	std::string_view source = argv[1];
+	std::size_t n_rows = argc > 2 ? std::stoul(argv[2]) : 1000000;
+	std::size_t n_runs = argc > 3 ? std::max(1ul, std::stoul(argv[3])) : 9;
+	try {
+		conftaal::Parser parser(source);
+		auto expr = parser.parse_expression();
+		if (!expr) throw conftaal::ParseError("missing expression", source);
+		conftaal::bench(*expr, n_rows, n_runs);
+	} catch (conftaal::Error & e) {
+		conftaal::print_error(e, "<expression>", source, false);
+		return 1;
+	}
+}
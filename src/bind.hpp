@@ -0,0 +1,241 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "error.hpp"
+#include "expression.hpp"
+
+// Decoding of configuration objects directly into C++ structs.
+//
+// Declare the fields of a struct once, by specializing ObjectBinding:
+//
+//     struct Server {
+//         std::string host;
+//         std::int64_t port = 80;
+//         std::vector<std::string> aliases;
+//     };
+//
+//     template<> struct conftaal::ObjectBinding<Server> {
+//         static constexpr auto binding = conftaal::binding(
+//             conftaal::field("host", &Server::host),
+//             conftaal::field("port", &Server::port),
+//             conftaal::field("aliases", &Server::aliases)
+//         );
+//     };
+//
+// Then conftaal::decode<Server>(expr) decodes an object into a Server.
+//
+// The field names are put in a perfect hash table at compile time, so
+// decoding an object is a single pass over its keys, with one hash and one
+// string comparison per key, storing each value directly into its member.
+
+namespace conftaal {
+
+// Thrown when a value does not match the type it is decoded into.
+class BindError : public Error {
+public:
+	using Error::Error;
+};
+
+template<typename T>
+struct ObjectBinding;
+
+template<typename S, typename T>
+struct Field {
+	std::string_view name;
+	T S::* member;
+};
+
+template<typename S, typename T>
+constexpr Field<S, T> field(std::string_view name, T S::* member) {
+	return {name, member};
+}
+
+template<typename T>
+T decode(Expression const &, std::string_view where = {});
+
+namespace bind_detail {
+
+constexpr std::uint32_t hash(std::string_view s, std::uint32_t seed) {
+	std::uint32_t h = seed ^ 2166136261u;
+	for (char c : s) h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+	return h ^ h >> 15;
+}
+
+// With at least n² slots, a random seed is collision free with a
+// probability of more than a half, so finding one is quick.
+constexpr std::size_t table_size(std::size_t n_fields) {
+	std::size_t size = 1;
+	while (size < n_fields * n_fields) size *= 2;
+	return size;
+}
+
+template<std::size_t N, std::size_t TableSize>
+struct PerfectHash {
+	static constexpr std::uint8_t empty = 0xFF;
+	static_assert(N < empty, "too many fields");
+
+	std::uint32_t seed = 0;
+	std::array<std::uint8_t, TableSize> table{};
+
+	constexpr explicit PerfectHash(std::array<std::string_view, N> const & names) {
+		for (std::size_t i = 0; i < N; ++i) {
+			for (std::size_t j = 0; j < i; ++j) {
+				// Not a constant expression, so this fails to compile.
+				if (names[i] == names[j]) throw std::logic_error("duplicate field name");
+			}
+		}
+		for (;; ++seed) {
+			for (auto & slot : table) slot = empty;
+			bool collision = false;
+			for (std::size_t i = 0; i < N && !collision; ++i) {
+				auto & slot = table[hash(names[i], seed) & (TableSize - 1)];
+				if (slot != empty) collision = true;
+				slot = i;
+			}
+			if (!collision) return;
+		}
+	}
+
+	constexpr std::size_t find(std::string_view name) const {
+		return table[hash(name, seed) & (TableSize - 1)];
+	}
+};
+
+template<typename T> struct is_vector : std::false_type {};
+template<typename T> struct is_vector<std::vector<T>> : std::true_type {};
+
+template<typename T, typename = void> struct has_binding : std::false_type {};
+template<typename T> struct has_binding<T, std::void_t<decltype(ObjectBinding<T>::binding)>> : std::true_type {};
+
+// A literal, or a negated literal, as negative numbers are parsed as unary
+// minus expressions.
+template<typename L>
+L const * literal(Expression const & e, bool & negated) {
+	auto o = dynamic_cast<OperatorExpression const *>(&e);
+	negated = o && o->op == Operator::unary_minus;
+	return dynamic_cast<L const *>(negated ? o->rhs.get() : &e);
+}
+
+template<typename T>
+void decode_value(Expression const & e, T & out, std::string_view where) {
+	if constexpr (std::is_same_v<T, bool>) {
+		static_assert(!std::is_same_v<T, bool>, "there are no boolean literals");
+	} else if constexpr (std::is_integral_v<T>) {
+		bool negated;
+		auto i = literal<IntegerLiteralExpression>(e, negated);
+		if (!i) throw BindError("expected integer", where);
+		// As sign and magnitude, as negating could overflow.
+		bool negative = negated != (i->value < 0);
+		std::uint64_t magnitude = i->value < 0 ? 0 - std::uint64_t(i->value) : std::uint64_t(i->value);
+		if (negative && magnitude != 0) {
+			if (!std::is_signed_v<T> || magnitude - 1 > std::uint64_t(std::numeric_limits<T>::max())) {
+				throw BindError("integer out of range", where);
+			}
+			out = T(-T(magnitude - 1) - 1);
+		} else {
+			if (magnitude > std::uint64_t(std::numeric_limits<T>::max())) {
+				throw BindError("integer out of range", where);
+			}
+			out = T(magnitude);
+		}
+	} else if constexpr (std::is_floating_point_v<T>) {
+		bool negated;
+		if (auto d = literal<DoubleLiteralExpression>(e, negated)) {
+			out = negated ? -T(d->value) : T(d->value);
+		} else if (auto i = literal<IntegerLiteralExpression>(e, negated)) {
+			out = negated ? -T(i->value) : T(i->value);
+		} else {
+			throw BindError("expected number", where);
+		}
+	} else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+		auto s = dynamic_cast<StringLiteralExpression const *>(&e);
+		if (!s) throw BindError("expected string", where);
+		out = T(s->value());
+	} else if constexpr (is_vector<T>::value) {
+		auto l = dynamic_cast<ListExpression const *>(&e);
+		if (!l) throw BindError("expected list", where);
+		out.clear();
+		out.resize(l->elements.size());
+		for (std::size_t i = 0; i < out.size(); ++i) {
+			decode_value(*l->elements[i], out[i], where);
+		}
+	} else if constexpr (has_binding<T>::value) {
+		auto o = dynamic_cast<ObjectExpression const *>(&e);
+		if (!o) throw BindError("expected object", where);
+		ObjectBinding<T>::binding.decode(*o, out);
+	} else {
+		static_assert(has_binding<T>::value, "no ObjectBinding for this type");
+	}
+}
+
+}
+
+template<typename S, typename... Fields>
+class Binding {
+public:
+	constexpr explicit Binding(Fields... fields)
+		: fields_(fields...), hash_({fields.name...}), names_{fields.name...} {}
+
+	// Decodes all keys of the object into the matching members. Members
+	// without a key in the object are left untouched. Errors point at the
+	// name of the key.
+	void decode(ObjectExpression const & object, S & out) const {
+		auto const & keys = object.keys->elements;
+		auto const & values = object.values->elements;
+		for (std::size_t i = 0; i < keys.size(); ++i) {
+			// The keys of an object are always string literals.
+			auto name = static_cast<StringLiteralExpression const &>(*keys[i]).value();
+			auto f = hash_.find(name);
+			if (f >= sizeof...(Fields) || names_[f] != name) throw BindError(
+				"unknown field `" + std::string(name) + "'",
+				name
+			);
+			decoders_[f](*this, *values[i], out, name);
+		}
+	}
+
+private:
+	using Decoder = void (*)(Binding const &, Expression const &, S &, std::string_view);
+
+	template<std::size_t I>
+	static void decode_field(Binding const & b, Expression const & e, S & out, std::string_view where) {
+		bind_detail::decode_value(e, out.*std::get<I>(b.fields_).member, where);
+	}
+
+	template<std::size_t... I>
+	static constexpr std::array<Decoder, sizeof...(I)> make_decoders(std::index_sequence<I...>) {
+		return {&decode_field<I>...};
+	}
+
+	std::tuple<Fields...> fields_;
+	bind_detail::PerfectHash<sizeof...(Fields), bind_detail::table_size(sizeof...(Fields))> hash_;
+	std::array<std::string_view, sizeof...(Fields)> names_;
+
+	static constexpr std::array<Decoder, sizeof...(Fields)> decoders_ =
+		make_decoders(std::index_sequence_for<Fields...>{});
+};
+
+template<typename S, typename... T>
+constexpr Binding<S, Field<S, T>...> binding(Field<S, T>... fields) {
+	return Binding<S, Field<S, T>...>(fields...);
+}
+
+template<typename T>
+T decode(Expression const & e, std::string_view where) {
+	T value{};
+	bind_detail::decode_value(e, value, where);
+	return value;
+}
+
+}
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <string_tracker.hpp>
+
+#include "diagnostics.hpp"
+#include "print_error.hpp"
+#include "utf8.hpp"
+
+namespace conftaal {
+
+LineIndex::LineIndex(std::string_view source) {
+	line_starts_.push_back(0);
+	for (auto p = source.data(), end = p + source.size(); ; ++p) {
+		p = static_cast<char const *>(std::memchr(p, '\n', end - p));
+		if (!p) break;
+		line_starts_.push_back(p + 1 - source.data());
+	}
+}
+
+LineColumn LineIndex::locate(std::size_t offset) const {
+	auto i = std::upper_bound(line_starts_.begin(), line_starts_.end(), offset) - 1;
+	return {std::size_t(i - line_starts_.begin()) + 1, offset - *i + 1};
+}
+
+LineIndex const & DiagnosticSink::Source::index() const {
+	if (!line_index) line_index = std::make_unique<LineIndex>(source);
+	return *line_index;
+}
+
+void DiagnosticSink::add_source(std::string file_name, std::string_view source) {
+	auto s = std::make_unique<Source>();
+	s->file_name = std::move(file_name);
+	s->source = source;
+	sources_[source.data()] = std::move(s);
+}
+
+DiagnosticSink::Message DiagnosticSink::message(std::string message, std::string_view where) const {
+	Message m{std::move(message), nullptr, {}};
+	if (where.data() == nullptr) return m;
+	auto find = [&] (char const * p) {
+		// The last source starting at or before p. A location at the end of
+		// a source that is directly followed by another one is taken to be
+		// at the start of the next one.
+		auto i = sources_.upper_bound(p);
+		if (i == sources_.begin()) return false;
+		auto & source = (--i)->second->source;
+		if (p > source.data() + source.size()) return false;
+		m.source = i->second.get();
+		m.where = SourceRange::of(std::string_view(p, where.size()), source);
+		return true;
+	};
+	if (!find(where.data()) && tracker_) {
+		if (auto original = tracker_->get(where); original.location) find(original.original_char);
+	}
+	return m;
+}
+
+void DiagnosticSink::add(Error const & error) {
+	Diagnostic d{message(error.what(), error.where), {}};
+	d.notes.reserve(error.notes.size());
+	for (auto const & note : error.notes) {
+		d.notes.push_back(message(note.first, note.second));
+	}
+	diagnostics_.push_back(std::move(d));
+}
+
+void DiagnosticSink::render(std::string & out, DiagnosticFormat format, bool color) const {
+	switch (format) {
+		case DiagnosticFormat::text: render_text(out, color); break;
+		case DiagnosticFormat::json: render_json(out); break;
+		case DiagnosticFormat::sarif: render_sarif(out); break;
+	}
+}
+
+void DiagnosticSink::render_text(std::string & out, bool color) const {
+	auto render_message = [&] (Message const & m, bool error) {
+		if (!m.source) {
+			format_message(out, {}, m.message, color, error);
+			return;
+		}
+		auto location = m.source->index().locate(m.where.offset);
+		std::string prefix = m.source->file_name;
+		prefix += ':';
+		prefix += std::to_string(location.line);
+		prefix += ':';
+		prefix += std::to_string(location.column);
+		format_message(out, prefix, m.message, color, error);
+		char const * begin = m.source->source.data() + m.where.offset;
+		format_source_snippet(out, m.source->source, begin, begin + m.where.size, location.column, color);
+	};
+	for (auto const & d : diagnostics_) {
+		render_message(d.error, true);
+		for (auto const & note : d.notes) render_message(note, false);
+	}
+}
+
+namespace {
+
+// Bytes that are not valid UTF-8, like in file names, are replaced by
+// U+FFFD, as JSON can't contain them.
+void append_json_string(std::string & out, std::string_view s) {
+	out += '"';
+	for (std::size_t i = 0; i < s.size(); ++i) {
+		char c = s[i];
+		if (auto byte = static_cast<unsigned char>(c); byte >= 0x80) {
+			std::size_t length = byte >= 0xF0 ? 4 : byte >= 0xE0 ? 3 : 2;
+			if (is_valid_utf8(s.substr(i, length))) {
+				out += s.substr(i, length);
+				i += length - 1;
+			} else {
+				out += "\\ufffd";
+			}
+			continue;
+		}
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					char buffer[7];
+					std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+					out += buffer;
+				} else {
+					out += c;
+				}
+		}
+	}
+	out += '"';
+}
+
+}
+
+void DiagnosticSink::render_json(std::string & out) const {
+	auto render_message = [&] (Message const & m) {
+		out += "{\"message\":";
+		append_json_string(out, m.message);
+		if (m.source) {
+			auto begin = m.source->index().locate(m.where.offset);
+			auto end = m.source->index().locate(m.where.offset + m.where.size);
+			out += ",\"file\":";
+			append_json_string(out, m.source->file_name);
+			out += ",\"line\":" + std::to_string(begin.line);
+			out += ",\"column\":" + std::to_string(begin.column);
+			out += ",\"end_line\":" + std::to_string(end.line);
+			out += ",\"end_column\":" + std::to_string(end.column);
+		}
+	};
+	out += '[';
+	for (auto const & d : diagnostics_) {
+		if (&d != &diagnostics_.front()) out += ',';
+		render_message(d.error);
+		out += ",\"notes\":[";
+		for (auto const & note : d.notes) {
+			if (&note != &d.notes.front()) out += ',';
+			render_message(note);
+			out += '}';
+		}
+		out += "]}";
+	}
+	out += "]\n";
+}
+
+namespace {
+
+// SARIF columns count code points, rather than bytes.
+std::size_t code_point_column(std::string_view source, std::size_t offset, LineColumn location) {
+	auto line = source.substr(offset - (location.column - 1), location.column - 1);
+	return 1 + std::count_if(line.begin(), line.end(), [] (char c) {
+		return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+	});
+}
+
+}
+
+void DiagnosticSink::render_sarif(std::string & out) const {
+	auto render_location = [&] (Message const & m) {
+		auto const & source = m.source->source;
+		auto begin = m.source->index().locate(m.where.offset);
+		auto end = m.source->index().locate(m.where.offset + m.where.size);
+		begin.column = code_point_column(source, m.where.offset, begin);
+		end.column = code_point_column(source, m.where.offset + m.where.size, end);
+		out += "\"physicalLocation\":{\"artifactLocation\":{\"uri\":";
+		append_json_string(out, m.source->file_name);
+		out += "},\"region\":{\"startLine\":" + std::to_string(begin.line);
+		out += ",\"startColumn\":" + std::to_string(begin.column);
+		out += ",\"endLine\":" + std::to_string(end.line);
+		out += ",\"endColumn\":" + std::to_string(end.column);
+		out += "}}";
+	};
+	out += "{\"version\":\"2.1.0\",";
+	out += "\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\",";
+	out += "\"runs\":[{\"tool\":{\"driver\":{\"name\":\"conftaal\"}},\"columnKind\":\"unicodeCodePoints\",\"results\":[";
+	for (auto const & d : diagnostics_) {
+		if (&d != &diagnostics_.front()) out += ',';
+		out += "{\"level\":\"error\",\"message\":{\"text\":";
+		append_json_string(out, d.error.message);
+		out += '}';
+		if (d.error.source) {
+			out += ",\"locations\":[{";
+			render_location(d.error);
+			out += "}]";
+		}
+		bool first = true;
+		for (auto const & note : d.notes) {
+			if (!note.source) continue;
+			out += first ? ",\"relatedLocations\":[{" : ",{";
+			first = false;
+			out += "\"message\":{\"text\":";
+			append_json_string(out, note.message);
+			out += "},";
+			render_location(note);
+			out += '}';
+		}
+		if (!first) out += ']';
+		out += '}';
+	}
+	out += "]}]}\n";
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <string_tracker.hpp>
+
+#include "error.hpp"
+#include "source_range.hpp"
+
+namespace conftaal {
+
+// The offsets of the starts of all lines in a source file.
+//
+// Finding the line and column of an offset is then a binary search,
+// instead of a scan through everything before it.
+class LineIndex {
+public:
+	explicit LineIndex(std::string_view source);
+
+	LineColumn locate(std::size_t offset) const;
+
+private:
+	std::vector<std::size_t> line_starts_;
+};
+
+enum class DiagnosticFormat {
+	text,
+	json,
+	sarif,
+};
+
+// Collects the errors of any number of source files, to render them all at
+// once into a single buffer.
+//
+// Sources must be added before errors located in them, and must stay alive
+// until the diagnostics are rendered. They may be adjacent slices of the
+// same buffer.
+//
+// JSON and SARIF output replace bytes that are not valid UTF-8 by U+FFFD.
+// SARIF columns count code points, text and JSON columns count bytes.
+class DiagnosticSink {
+public:
+	// The tracker, if given, is used to find the location of errors that do
+	// not point into any of the added sources, such as errors in decoded
+	// string literals.
+	explicit DiagnosticSink(string_pool::string_tracker const * tracker = nullptr)
+		: tracker_(tracker) {}
+
+	void add_source(std::string file_name, std::string_view source);
+
+	void add(Error const &);
+
+	std::size_t size() const { return diagnostics_.size(); }
+	bool empty() const { return diagnostics_.empty(); }
+
+	void render(std::string & out, DiagnosticFormat, bool color = false) const;
+	void render_text(std::string & out, bool color = false) const;
+	void render_json(std::string & out) const;
+	void render_sarif(std::string & out) const;
+
+private:
+	struct Source {
+		std::string file_name;
+		std::string_view source;
+		mutable std::unique_ptr<LineIndex> line_index; // Built on first use.
+		LineIndex const & index() const;
+	};
+
+	struct Message {
+		std::string message;
+		Source const * source = nullptr; // Null if the location is unknown.
+		SourceRange where;
+	};
+
+	struct Diagnostic {
+		Message error;
+		std::vector<Message> notes;
+	};
+
+	Message message(std::string message, std::string_view where) const;
+
+	// Ends of the sources, to find the source of a location.
+	std::map<char const *, std::unique_ptr<Source>> sources_;
+	std::vector<Diagnostic> diagnostics_;
+	string_pool::string_tracker const * tracker_;
+};
+
+}
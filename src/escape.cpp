@@ -0,0 +1,217 @@
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "escape.hpp"
+#include "parse.hpp"
+#include "utf8.hpp"
+
+namespace conftaal {
+
+int digit_value(char c) {
+	switch (c) {
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			return c - '0';
+		case 'a': case 'A': return 10;
+		case 'b': case 'B': return 11;
+		case 'c': case 'C': return 12;
+		case 'd': case 'D': return 13;
+		case 'e': case 'E': return 14;
+		case 'f': case 'F': return 15;
+		default:
+			return -1;
+	}
+}
+
+std::size_t find_quote_or_backslash(std::string_view source, char quote) {
+	std::size_t i = 0;
+#ifdef __SSE2__
+	__m128i const quotes = _mm_set1_epi8(quote);
+	__m128i const backslashes = _mm_set1_epi8('\\');
+	for (; i + 16 <= source.size(); i += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(source.data() + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(chunk, quotes),
+			_mm_cmpeq_epi8(chunk, backslashes)
+		));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+#endif
+	while (i < source.size() && source[i] != quote && source[i] != '\\') ++i;
+	return i;
+}
+
+namespace {
+
+int parse_hex_digit(std::string_view & s) {
+	if (!s.empty()) {
+		int value = digit_value(s[0]);
+		if (value != -1) {
+			s.remove_prefix(1);
+			return value;
+		}
+	}
+	throw ParseError("expected hexadecimal digit (0-9, a-f, A-F)", s.substr(0, 0));
+}
+
+}
+
+size_t encode_utf8(char32_t codepoint, char (& buffer)[4]) {
+	if (codepoint < 0x80) {
+		buffer[0] = codepoint;
+		return 1;
+	} else if (codepoint < 0x800) {
+		buffer[0] = 0xC0 | codepoint >> 6;
+		buffer[1] = 0x80 | (codepoint & 0x3F);
+		return 2;
+	} else if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
+		return 0;
+	} else if (codepoint < 0x10000) {
+		buffer[0] = 0xE0 | codepoint >> 12;
+		buffer[1] = 0x80 | (codepoint >> 6 & 0x3F);
+		buffer[2] = 0x80 | (codepoint & 0x3F);
+		return 3;
+	} else if (codepoint < 0x110000) {
+		buffer[0] = 0xF0 | codepoint >> 18;
+		buffer[1] = 0x80 | (codepoint >> 12 & 0x3F);
+		buffer[2] = 0x80 | (codepoint >> 6 & 0x3F);
+		buffer[3] = 0x80 | (codepoint & 0x3F);
+		return 4;
+	} else {
+		return 0;
+	}
+}
+
+EscapeSequence parse_escape_sequence(std::string_view & source, char (& buffer)[4]) {
+	assert(!source.empty() && source[0] == '\\');
+	if (source.size() < 2) throw ParseError("incomplete escape sequence", source);
+	switch (source[1]) {
+		case '\\': case '"':
+		case 't': case 'n': case 'r':
+		case 'b': case 'a': case 'e':
+		case 'f': case 'v': {
+			std::string_view replacement;
+			switch (source[1]) {
+				case '\\': replacement = "\\"; break;
+				case '"': replacement = "\""; break;
+				case 't': replacement = "\t"; break;
+				case 'n': replacement = "\n"; break;
+				case 'r': replacement = "\r"; break;
+				case 'b': replacement = "\b"; break;
+				case 'a': replacement = "\a"; break;
+				case 'e': replacement = "\033"; break;
+				case 'f': replacement = "\f"; break;
+				case 'v': replacement = "\v"; break;
+			}
+			auto escape_sequence = source.substr(0, 2);
+			source.remove_prefix(2);
+			return {replacement, escape_sequence};
+		}
+		case '\n': {
+			auto escape_sequence = source.substr(0, 2);
+			source.remove_prefix(2);
+			return {{}, escape_sequence};
+		}
+		case 'x': {
+			// 8-bit byte in hex
+			auto escape_sequence = source.substr(0, 4);
+			source.remove_prefix(2);
+			int a = parse_hex_digit(source);
+			int b = parse_hex_digit(source);
+			buffer[0] = a << 4 | b;
+			return {std::string_view(buffer, 1), escape_sequence, a >= 8};
+		}
+		case 'u':
+		case 'U': {
+			// 16-bit ('u') or 32-bit ('U') unicode codepoint in hex
+			int n_digits = source[1] == 'u' ? 4 : 8;
+			auto escape_sequence = source.substr(0, 2 + n_digits);
+			source.remove_prefix(2);
+			char32_t codepoint = 0;
+			for (int i = 0; i < n_digits; ++i) {
+				codepoint <<= 4;
+				codepoint |= parse_hex_digit(source);
+			}
+			if (size_t n_bytes = encode_utf8(codepoint, buffer)) {
+				return {std::string_view(buffer, n_bytes), escape_sequence};
+			} else {
+				throw ParseError(
+					"invalid unicode codepoint",
+					escape_sequence
+				);
+			}
+		}
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7': {
+			// 8-bit byte in octal (1-3 digits)
+			auto escape_sequence_start = source.data();
+			int value = source[1] - '0';
+			source.remove_prefix(2);
+			int n_digits = 1;
+			while (n_digits < 3 && !source.empty() && source[0] >= '0' && source[0] <= '7') {
+				value <<= 3;
+				value |= source[0] - '0';
+				++n_digits;
+				source.remove_prefix(1);
+			}
+			std::string_view escape_sequence(escape_sequence_start, source.data() - escape_sequence_start);
+			if (value > 255) throw ParseError("octal escape sequence out of range", escape_sequence);
+			buffer[0] = value;
+			return {std::string_view(buffer, 1), escape_sequence, value >= 0x80};
+		}
+		default:
+			throw ParseError("invalid escape sequence", source.substr(0, 2));
+	}
+}
+
+void decode_string_literal(std::string_view source, std::string & out) {
+	out.reserve(out.size() + source.size());
+	char buffer[4];
+	while (true) {
+		// memchr is vectorized, and the runs between escape sequences
+		// are copied in bulk.
+		auto backslash = static_cast<char const *>(std::memchr(source.data(), '\\', source.size()));
+		if (!backslash) break;
+		out.append(source.data(), backslash - source.data());
+		source.remove_prefix(backslash - source.data());
+		out += parse_escape_sequence(source, buffer).value;
+	}
+	out += source;
+}
+
+void check_byte_escapes(std::string_view source) {
+	auto const literal = source;
+	std::string value;
+	// The offsets in the value of the escaped bytes, and their sources.
+	std::vector<std::pair<std::size_t, std::string_view>> bytes;
+	char buffer[4];
+	while (true) {
+		auto backslash = static_cast<char const *>(std::memchr(source.data(), '\\', source.size()));
+		if (!backslash) break;
+		value.append(source.data(), backslash - source.data());
+		source.remove_prefix(backslash - source.data());
+		auto escape_sequence = parse_escape_sequence(source, buffer);
+		if (escape_sequence.non_ascii_byte) bytes.emplace_back(value.size(), escape_sequence.source);
+		value += escape_sequence.value;
+	}
+	value += source;
+
+	auto invalid = find_invalid_utf8(value);
+	if (invalid == std::string_view::npos) return;
+	// The source itself is valid UTF-8, so the invalid sequence starts at
+	// one of the escaped bytes.
+	for (auto const & byte : bytes) {
+		if (byte.first >= invalid) throw ParseError("escape sequence results in invalid UTF-8", byte.second);
+	}
+	throw ParseError("string literal is not valid UTF-8", literal);
+}
+
+}
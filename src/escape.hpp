@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace conftaal {
+
+// The value of a decimal or hexadecimal digit, or -1 if it isn't one.
+int digit_value(char c);
+
+// The index of the first `quote' or backslash in the source, or source.size().
+std::size_t find_quote_or_backslash(std::string_view source, char quote);
+
+struct EscapeSequence {
+	std::string_view value;
+	std::string_view source;
+
+	// A \x or octal escape for a byte of 0x80 or above, which is only valid
+	// UTF-8 together with the bytes around it.
+	bool non_ascii_byte = false;
+};
+
+// Writes the UTF-8 encoding of the codepoint into the buffer, and returns
+// its length. Returns 0 for surrogates and codepoints above U+10FFFF.
+std::size_t encode_utf8(char32_t codepoint, char (& buffer)[4]);
+
+// Parses the escape sequence at the start of the source (which must start
+// with a backslash), and removes it from the source.
+//
+// The value might refer to the buffer. Throws a ParseError if the escape
+// sequence is invalid. Unicode escape sequences always result in valid
+// UTF-8: surrogates and codepoints above U+10FFFF are rejected.
+EscapeSequence parse_escape_sequence(std::string_view & source, char (& buffer)[4]);
+
+// Appends the value of the source between the quotes of a string literal
+// to 'out'. All escape sequences in the source must be valid.
+void decode_string_literal(std::string_view source, std::string & out);
+
+// Throws a ParseError pointing at the first escape sequence in the source
+// between the quotes of a string literal that makes its value invalid
+// UTF-8. The rest of the source must be valid UTF-8, and all escape
+// sequences must be valid. Only needed when one of them has non_ascii_byte
+// set.
+void check_byte_escapes(std::string_view source);
+
+}
@@ -0,0 +1,110 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "escape.hpp"
+#include "expression.hpp"
+
+namespace conftaal {
+
+namespace {
+
+// The children of the expressions being destroyed on this thread, if any.
+thread_local std::vector<refcount_ptr<Expression const>> * orphans = nullptr;
+
+// Destroys what is on the stack one by one. The destructors this runs add
+// their children to the stack, instead of destroying them recursively.
+void destroy_orphans(std::vector<refcount_ptr<Expression const>> & stack) {
+	orphans = &stack;
+	while (!stack.empty()) {
+		auto e = std::move(stack.back());
+		stack.pop_back();
+	}
+	orphans = nullptr;
+}
+
+template<typename... T>
+void release(T &&... children) {
+	std::vector<refcount_ptr<Expression const>> stack;
+	auto & out = orphans ? *orphans : stack;
+	((children ? out.push_back(std::move(children)) : void()), ...);
+	if (!orphans) destroy_orphans(stack);
+}
+
+}
+
+OperatorExpression::~OperatorExpression() {
+	release(std::move(lhs), std::move(rhs));
+}
+
+LambdaExpression::~LambdaExpression() {
+	release(std::move(body));
+}
+
+ImportExpression::~ImportExpression() {
+	release(std::move(path), std::move(module));
+}
+
+ListExpression::~ListExpression() {
+	if (orphans) {
+		for (auto & e : elements) orphans->push_back(std::move(e));
+	} else {
+		destroy_orphans(elements);
+	}
+}
+
+ObjectExpression::~ObjectExpression() {
+	release(std::move(keys), std::move(values));
+}
+
+struct StringLiteralExpression::Escaped {
+	std::once_flag decoded_flag;
+	std::string decoded;
+};
+
+StringLiteralExpression::StringLiteralExpression(string_view value) : value_(value) {}
+
+StringLiteralExpression::~StringLiteralExpression() = default;
+
+std::unique_ptr<StringLiteralExpression> StringLiteralExpression::escaped(string_view source) {
+	auto e = std::make_unique<StringLiteralExpression>(source);
+	e->escaped_ = std::make_unique<Escaped>();
+	return e;
+}
+
+std::unique_ptr<StringLiteralExpression> StringLiteralExpression::decoded(string_view source, std::string value) {
+	auto e = escaped(source);
+	std::call_once(e->escaped_->decoded_flag, [&] {
+		e->escaped_->decoded = std::move(value);
+	});
+	return e;
+}
+
+string_view StringLiteralExpression::value() const {
+	if (!escaped_) return value_;
+	std::call_once(escaped_->decoded_flag, [this] {
+		decode_string_literal(value_, escaped_->decoded);
+	});
+	return escaped_->decoded;
+}
+
+std::size_t StringLiteralExpression::decoded_bytes() const {
+	if (!escaped_) return 0;
+	auto const & decoded = escaped_->decoded;
+	auto data = reinterpret_cast<std::uintptr_t>(decoded.data());
+	auto self = reinterpret_cast<std::uintptr_t>(&decoded);
+	// Short strings are stored inside the std::string itself.
+	bool small = data >= self && data < self + sizeof(decoded);
+	return small ? 0 : decoded.capacity() + 1;
+}
+
+std::size_t StringLiteralExpression::escaped_state_bytes() const {
+	return escaped_ ? sizeof(Escaped) : 0;
+}
+
+}
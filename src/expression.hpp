@@ -1,8 +1,10 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -19,6 +21,8 @@ using mstd::take_or_copy;
 using mstd::static_pointer_cast;
 using mstd::dynamic_pointer_cast;
 
+// Expressions with children destroy those without recursion, so even the
+// deepest trees can't overflow the call stack when they are dropped.
 class Expression : public refcounted {
 public:
 	virtual ~Expression() {}
@@ -42,6 +46,8 @@ public:
 		refcount_ptr<Expression const> rhs
 	) : op(op), op_source(op_source), lhs(std::move(lhs)), rhs(std::move(rhs)) {}
 
+	~OperatorExpression();
+
 	Operator op;
 	string_view op_source;
 	refcount_ptr<Expression const> lhs;
@@ -52,6 +58,20 @@ public:
 	bool is_unary() const { return lhs == nullptr; }
 };
 
+// A function, like `\x, y -> x + y'.
+class LambdaExpression final : public Expression {
+public:
+	LambdaExpression(
+		std::vector<string_view> parameters,
+		refcount_ptr<Expression const> body
+	) : parameters(std::move(parameters)), body(std::move(body)) {}
+
+	~LambdaExpression();
+
+	std::vector<string_view> parameters;
+	refcount_ptr<Expression const> body;
+};
+
 class LiteralExpression : public Expression {
 public:
 	LiteralExpression() {}
@@ -73,10 +93,70 @@ public:
 
 class StringLiteralExpression final : public LiteralExpression {
 public:
-	explicit StringLiteralExpression(string_view value)
-		: value(value) {}
+	explicit StringLiteralExpression(string_view value);
+
+	~StringLiteralExpression();
+
+	// Creates a literal from the source between its quotes, without decoding
+	// its escape sequences yet. The escape sequences must be valid.
+	static std::unique_ptr<StringLiteralExpression> escaped(string_view source);
+
+	// Creates a literal from source with escape sequences other than those
+	// of conftaal, like JSON, which were already decoded into the value.
+	static std::unique_ptr<StringLiteralExpression> decoded(string_view source, std::string value);
+
+	// Decodes the escape sequences on first use, if that didn't happen yet.
+	string_view value() const;
+
+	// True if value() is not just source().
+	bool has_escapes() const { return escaped_ != nullptr; }
+
+	// The source between the quotes, if this literal was created by escaped().
+	// Otherwise, the same as value().
+	string_view source() const { return value_; }
+
+	// The bytes allocated for the value decoded by value(), if any. Must not
+	// be called while value() might be decoding on another thread.
+	std::size_t decoded_bytes() const;
+
+	// The bytes allocated for decoding the value once, if has_escapes().
+	std::size_t escaped_state_bytes() const;
 
-	string_view value;
+private:
+	// Allocated separately, so literals without escape sequences don't pay
+	// for it.
+	struct Escaped;
+
+	string_view value_;
+	std::unique_ptr<Escaped> escaped_;
+};
+
+// An import of another file, like `import "common.conf"'.
+class ImportExpression final : public Expression {
+public:
+	ImportExpression(
+		string_view source,
+		refcount_ptr<StringLiteralExpression const> path
+	) : source(source), path(std::move(path)) {}
+
+	~ImportExpression();
+
+	// The entire `import "..."'.
+	string_view source;
+	refcount_ptr<StringLiteralExpression const> path;
+
+	// Filled in by ModuleLoader: the contents of the imported file.
+	mutable refcount_ptr<Expression const> module;
+};
+
+// Source that could not be parsed, from a Parser that recovers from errors
+// (see ParseOptions::recover).
+class ErrorExpression final : public Expression {
+public:
+	explicit ErrorExpression(string_view source) : source(source) {}
+
+	// The source that was skipped.
+	string_view source;
 };
 
 class ListExpression final : public Expression {
@@ -85,6 +165,8 @@ public:
 		std::vector<refcount_ptr<Expression const>> elements
 	) : elements(std::move(elements)) {}
 
+	~ListExpression();
+
 	std::vector<refcount_ptr<Expression const>> elements;
 };
 
@@ -97,6 +179,8 @@ public:
 		assert(this->keys->elements.size() == this->values->elements.size());
 	}
 
+	~ObjectExpression();
+
 	refcount_ptr<ListExpression const> keys;
 	refcount_ptr<ListExpression const> values;
 };
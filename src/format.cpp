@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "error.hpp"
+#include "format.hpp"
+#include "parse.hpp"
+
+namespace conftaal {
+
+namespace {
+
+string_view spelling(Operator op) {
+	switch (op) {
+		case Operator::dot:              return ".";
+		case Operator::index:            return "[";
+		case Operator::call:             return "(";
+		case Operator::colon:            return " : ";
+		case Operator::equal:            return " == ";
+		case Operator::inequal:          return " != ";
+		case Operator::greater:          return " > ";
+		case Operator::less:             return " < ";
+		case Operator::greater_or_equal: return " >= ";
+		case Operator::less_or_equal:    return " <= ";
+		case Operator::unary_plus:       return "+";
+		case Operator::unary_minus:      return "-";
+		case Operator::complement:       return "~";
+		case Operator::logical_not:      return "!";
+		case Operator::plus:             return " + ";
+		case Operator::minus:            return " - ";
+		case Operator::times:            return " * ";
+		case Operator::divide:           return " / ";
+		case Operator::modulo:           return " % ";
+		case Operator::power:            return " ** ";
+		case Operator::left_shift:       return " << ";
+		case Operator::right_shift:      return " >> ";
+		case Operator::bit_and:          return " & ";
+		case Operator::bit_or:           return " | ";
+		case Operator::bit_xor:          return " ^ ";
+		case Operator::logical_and:      return " && ";
+		case Operator::logical_or:       return " || ";
+	}
+	std::abort();
+}
+
+bool needs_escape(unsigned char c) {
+	return c < 0x20 || c == 0x7F || c == '"' || c == '\\';
+}
+
+// The number of bytes at the start of s that can be copied into a string
+// literal as they are.
+std::size_t plain_prefix(unsigned char const * s, std::size_t size) {
+	std::size_t i = 0;
+#ifdef __SSE2__
+	// Check 16 bytes at a time for control characters, quotes and backslashes.
+	__m128i const max_control = _mm_set1_epi8(0x1F);
+	__m128i const del = _mm_set1_epi8(0x7F);
+	__m128i const quote = _mm_set1_epi8('"');
+	__m128i const backslash = _mm_set1_epi8('\\');
+	while (i + 16 <= size) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+		__m128i special = _mm_or_si128(
+			_mm_or_si128(
+				_mm_cmpeq_epi8(_mm_max_epu8(x, max_control), max_control),
+				_mm_cmpeq_epi8(x, del)
+			),
+			_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash))
+		);
+		if (int mask = _mm_movemask_epi8(special)) return i + __builtin_ctz(mask);
+		i += 16;
+	}
+#endif
+	while (i < size && !needs_escape(s[i])) ++i;
+	return i;
+}
+
+void append_string(std::string & out, string_view s) {
+	auto const bytes = reinterpret_cast<unsigned char const *>(s.data());
+	out += '"';
+	std::size_t i = 0;
+	while (true) {
+		std::size_t n = plain_prefix(bytes + i, s.size() - i);
+		out.append(s.data() + i, n);
+		i += n;
+		if (i == s.size()) break;
+		unsigned char c = bytes[i++];
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default: {
+				char const digits[] = "0123456789abcdef";
+				char const escape[4] = {'\\', 'x', digits[c >> 4], digits[c & 0xF]};
+				out.append(escape, 4);
+			}
+		}
+	}
+	out += '"';
+}
+
+void append_integer(std::string & out, std::int64_t value) {
+	char buffer[24];
+	auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+	out.append(buffer, end);
+}
+
+void append_double(std::string & out, double value) {
+	if (std::isinf(value)) {
+		// Too large for a double, so read back as infinity.
+		out += value < 0 ? "-1e999" : "1e999";
+		return;
+	}
+	char buffer[32];
+	auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+	out.append(buffer, end);
+	// Without a `.' or an exponent, it would be read back as an integer.
+	if (std::find_if(buffer, end, [] (char c) { return c == '.' || c == 'e'; }) == end) out += ".0";
+}
+
+OperatorExpression const * as_operator(Expression const & e) {
+	return typeid(e) == typeid(OperatorExpression) ? static_cast<OperatorExpression const *>(&e) : nullptr;
+}
+
+// Whether an operand of op needs parentheses to be parsed back as such.
+bool needs_parentheses(Expression const & operand, Operator op, order side) {
+	// The body of a lambda extends as far as possible.
+	if (typeid(operand) == typeid(LambdaExpression)) return true;
+	auto e = as_operator(operand);
+	if (!e) return false;
+	return side == order::left
+		? higher_precedence(e->op, op) != order::left
+		: higher_precedence(op, e->op) != order::right;
+}
+
+class Formatter {
+public:
+	Formatter(std::string & out, FormatOptions options)
+		: out_(out), options_(options) {}
+
+	void expression(Expression const & expr) {
+		auto const & type = typeid(expr);
+		if (type == typeid(OperatorExpression)) {
+			operator_expression(static_cast<OperatorExpression const &>(expr));
+		} else if (type == typeid(IdentifierExpression)) {
+			out_ += static_cast<IdentifierExpression const &>(expr).identifier;
+		} else if (type == typeid(StringLiteralExpression)) {
+			append_string(out_, static_cast<StringLiteralExpression const &>(expr).value());
+		} else if (type == typeid(IntegerLiteralExpression)) {
+			append_integer(out_, static_cast<IntegerLiteralExpression const &>(expr).value);
+		} else if (type == typeid(DoubleLiteralExpression)) {
+			append_double(out_, static_cast<DoubleLiteralExpression const &>(expr).value);
+		} else if (type == typeid(ObjectExpression)) {
+			object(static_cast<ObjectExpression const &>(expr));
+		} else if (type == typeid(ListExpression)) {
+			list(static_cast<ListExpression const &>(expr));
+		} else if (type == typeid(LambdaExpression)) {
+			lambda(static_cast<LambdaExpression const &>(expr));
+		} else if (type == typeid(ImportExpression)) {
+			out_ += "import ";
+			append_string(out_, static_cast<ImportExpression const &>(expr).path->value());
+		} else if (type == typeid(ErrorExpression)) {
+			// Left as it was, as there's no telling what it should be.
+			out_ += static_cast<ErrorExpression const &>(expr).source;
+		}
+	}
+
+private:
+	std::string & out_;
+	FormatOptions options_;
+	std::size_t depth_ = 0;
+
+	void operand(Expression const & e, bool parentheses) {
+		if (parentheses) out_ += '(';
+		expression(e);
+		if (parentheses) out_ += ')';
+	}
+
+	void operator_expression(OperatorExpression const & e) {
+		if (e.is_unary()) {
+			// Unary operators apply directly to the atom after them, which
+			// may itself be a unary operator expression.
+			auto inner = as_operator(*e.rhs);
+			out_ += spelling(e.op);
+			operand(*e.rhs, !(inner && inner->is_unary()) && needs_parentheses(*e.rhs, e.op, order::right));
+			return;
+		}
+		// Left-nested chains, like `a + b + c', are the shape the parser
+		// produces for long expressions, so they are written without
+		// recursing: the innermost left hand side first, and then every
+		// operator with its right hand side, from the inside out.
+		std::vector<OperatorExpression const *> chain{&e};
+		while (auto lhs = as_operator(*chain.back()->lhs)) {
+			if (lhs->is_unary() || needs_parentheses(*lhs, chain.back()->op, order::left)) break;
+			chain.push_back(lhs);
+		}
+		auto const & innermost = *chain.back();
+		// `1.x' would be read as `1.' followed by `x'.
+		bool integer_lhs = innermost.op == Operator::dot && typeid(*innermost.lhs) == typeid(IntegerLiteralExpression);
+		operand(*innermost.lhs, integer_lhs || needs_parentheses(*innermost.lhs, innermost.op, order::left));
+		for (auto i = chain.rbegin(); i != chain.rend(); ++i) right_hand_side(**i);
+	}
+
+	void right_hand_side(OperatorExpression const & e) {
+		out_ += spelling(e.op);
+		if (e.op == Operator::call || e.op == Operator::index) {
+			if (typeid(*e.rhs) == typeid(ListExpression)) {
+				elements(static_cast<ListExpression const &>(*e.rhs));
+			} else {
+				expression(*e.rhs);
+			}
+			out_ += e.op == Operator::call ? ')' : ']';
+		} else {
+			operand(*e.rhs, needs_parentheses(*e.rhs, e.op, order::right));
+		}
+	}
+
+	void lambda(LambdaExpression const & e) {
+		out_ += '\\';
+		for (std::size_t i = 0; i < e.parameters.size(); ++i) {
+			if (i) out_ += ", ";
+			out_ += e.parameters[i];
+		}
+		out_ += e.parameters.empty() ? "-> " : " -> ";
+		expression(*e.body);
+	}
+
+	void indent() {
+		out_.append(depth_, '\t');
+	}
+
+	void object(ObjectExpression const & e) {
+		auto const & keys = e.keys->elements;
+		auto const & values = e.values->elements;
+		if (keys.empty()) {
+			out_ += "{}";
+		} else if (options_.compact) {
+			out_ += '{';
+			for (std::size_t i = 0; i < keys.size(); ++i) {
+				if (i) out_ += ", ";
+				key(*keys[i]);
+				out_ += " = ";
+				expression(*values[i]);
+			}
+			out_ += '}';
+		} else {
+			out_ += "{\n";
+			++depth_;
+			for (std::size_t i = 0; i < keys.size(); ++i) {
+				indent();
+				key(*keys[i]);
+				out_ += " = ";
+				expression(*values[i]);
+				out_ += '\n';
+			}
+			--depth_;
+			indent();
+			out_ += '}';
+		}
+	}
+
+	void key(Expression const & e) {
+		if (typeid(e) == typeid(StringLiteralExpression)) {
+			auto const & s = static_cast<StringLiteralExpression const &>(e);
+			auto name = s.value();
+			if (!Parser::is_identifier(name)) throw Error("key `" + std::string(name) + "' is not an identifier", s.source());
+			out_ += name;
+		} else {
+			expression(e);
+		}
+	}
+
+	static bool is_multi_line(Expression const & e) {
+		return typeid(e) == typeid(ObjectExpression) &&
+			!static_cast<ObjectExpression const &>(e).keys->elements.empty();
+	}
+
+	void elements(ListExpression const & e) {
+		for (std::size_t i = 0; i < e.elements.size(); ++i) {
+			if (i) out_ += ", ";
+			expression(*e.elements[i]);
+		}
+	}
+
+	void list(ListExpression const & e) {
+		// Lists of objects get one element per line, others a single line.
+		if (options_.compact || std::none_of(e.elements.begin(), e.elements.end(), [] (auto const & v) { return is_multi_line(*v); })) {
+			out_ += '[';
+			elements(e);
+			out_ += ']';
+		} else {
+			out_ += "[\n";
+			++depth_;
+			for (auto const & v : e.elements) {
+				indent();
+				expression(*v);
+				out_ += '\n';
+			}
+			--depth_;
+			indent();
+			out_ += ']';
+		}
+	}
+};
+
+}
+
+void format(Expression const & expr, std::string & out, FormatOptions options) {
+	Formatter(out, options).expression(expr);
+}
+
+std::string format(Expression const & expr, FormatOptions options) {
+	std::string out;
+	format(expr, out, options);
+	return out;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include "expression.hpp"
+
+namespace conftaal {
+
+struct FormatOptions {
+	// Write objects and lists on a single line, like `{a = 1, b = [2, 3]}',
+	// instead of one key per line, indented with tabs.
+	bool compact = false;
+};
+
+// Writes the expression as conftaal source, appending it to out.
+//
+// The output is canonical: parsing it results in the same expression,
+// regardless of how the original source was formatted. Strings are
+// re-escaped, and parentheses are only written where the precedence and
+// associativity of the operators require them.
+//
+// Throws an Error for keys that are not identifiers, which can't be
+// written as conftaal source.
+void format(Expression const &, std::string & out, FormatOptions = {});
+
+std::string format(Expression const &, FormatOptions = {});
+
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "expression.hpp"
+#include "parse.hpp"
+
+// Searches for inputs that take super-linear time or memory to parse.
+//
+// Inputs come in families described by a pattern, in which the parts
+// between `$'s are repeated n times, with any `@' in them replaced by the
+// number of the repetition. For example, `$($1$)$' describes `(1)', `((1))',
+// and so on, and `[$x@, $]' describes lists of distinct identifiers.
+//
+// Each family is parsed at a few sizes, to see how the work done by the
+// Parser (see ParseStats), the memory it allocates, and the time it takes
+// grow with the size of the input.
+//
+// With pattern files as arguments, checks those, and exits with a non-zero
+// status if any of them grows super-linearly. Without, tries random
+// patterns, and prints (and optionally saves) the ones that do.
+
+namespace conftaal {
+
+namespace {
+
+std::string expand(std::string_view pattern, std::size_t n) {
+	std::string out;
+	while (!pattern.empty()) {
+		auto start = pattern.find('$');
+		out += pattern.substr(0, start);
+		if (start == std::string_view::npos) break;
+		pattern.remove_prefix(start + 1);
+		auto end = pattern.find('$');
+		auto part = pattern.substr(0, end);
+		for (std::size_t i = 0; i < n; ++i) {
+			for (char c : part) {
+				if (c == '@') {
+					out += std::to_string(i);
+				} else {
+					out += c;
+				}
+			}
+		}
+		if (end == std::string_view::npos) break;
+		pattern.remove_prefix(end + 1);
+	}
+	return out;
+}
+
+struct Cost {
+	std::size_t bytes = 0; // Of the source.
+	ParseStats stats;
+	double seconds = 0;
+	bool too_slow = false;
+};
+
+Cost measure(std::string const & source) {
+	ParseOptions options;
+	options.limits.max_time = std::chrono::seconds(1);
+	Cost cost;
+	cost.bytes = source.size();
+	cost.seconds = INFINITY;
+	// The fastest of a few runs, to get rid of most of the noise.
+	for (int run = 0; run < 3; ++run) {
+		Parser parser(source, options);
+		std::unique_ptr<Expression> expr;
+		auto start = std::chrono::steady_clock::now();
+		try {
+			expr = parser.parse_expression();
+		} catch (ParseLimitError &) {
+			cost.too_slow = true;
+		} catch (ParseError &) {
+			// Still counts: errors can be slow to get to as well.
+		}
+		std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+		cost.seconds = std::min(cost.seconds, time.count());
+		cost.stats = parser.stats();
+		if (cost.too_slow) break;
+	}
+	return cost;
+}
+
+// How a cost grows with the size of the input: 1 for linear, 2 for
+// quadratic.
+double exponent(double small_cost, double large_cost, double small_size, double large_size) {
+	if (small_cost <= 0 || large_cost <= small_cost) return 0;
+	return std::log(large_cost / small_cost) / std::log(large_size / small_size);
+}
+
+struct Growth {
+	double steps = 0;
+	double allocated = 0;
+	double time = 0;
+	std::size_t max_depth = 0;
+	bool too_slow = false;
+
+	bool super_linear() const {
+		// Time is only a hint, as it's noisy and includes effects of caches.
+		return too_slow || steps > 1.25 || allocated > 1.25 || time > 1.8;
+	}
+};
+
+Growth growth(std::string_view pattern) {
+	Growth g;
+	Cost a;
+	Cost b = measure(expand(pattern, 64));
+	for (std::size_t n = 128; n <= 4096 && !b.too_slow; n *= 2) {
+		a = b;
+		b = measure(expand(pattern, n));
+		g.too_slow = b.too_slow;
+		g.steps = exponent(a.stats.steps, b.stats.steps, a.bytes, b.bytes);
+		g.allocated = exponent(a.stats.allocated_bytes, b.stats.allocated_bytes, a.bytes, b.bytes);
+		// Below a millisecond, it's mostly noise.
+		g.time = b.seconds > 1e-3 ? exponent(a.seconds, b.seconds, a.bytes, b.bytes) : 0;
+		g.max_depth = b.stats.max_depth;
+		// Only go beyond 1024 repetitions to see if a slow down in time
+		// is real.
+		if (n >= 1024 && (g.time <= 1.8 || g.steps > 1.25 || g.allocated > 1.25)) break;
+	}
+	return g;
+}
+
+void print(std::string_view name, Growth const & g) {
+	std::cout << name << ": ";
+	if (g.too_slow) {
+		std::cout << "took more than a second";
+	} else {
+		std::cout << "steps ^" << std::round(g.steps * 100) / 100;
+		std::cout << ", allocated ^" << std::round(g.allocated * 100) / 100;
+		if (g.time) std::cout << ", time ^" << std::round(g.time * 100) / 100;
+		std::cout << ", depth " << g.max_depth;
+	}
+	if (g.super_linear()) std::cout << " (super-linear)";
+	std::cout << std::endl;
+}
+
+char const * const atoms[] = {"a", "1", "x@", "\"s\"", "\"\\n\"", "1.5"};
+char const * const operators[] = {"+", "-", "*", "**", "==", "<", "&&", "||", ".", ":", "|", "<<"};
+char const * const openers[] = {"(", "[", "{x@ =", "-", "!", "~", "\\x ->", "\\x@, y ->", "a(", "a["};
+char const * const others[] = {",", ";", "\n", ")", "]", "}"};
+
+// A random pattern: some tokens repeated n times, followed by an atom and
+// whatever brackets that leaves open.
+std::string random_pattern(std::mt19937_64 & rng) {
+	auto pick = [&] (auto const & list) -> std::string_view {
+		return list[std::uniform_int_distribution<std::size_t>(0, std::size(list) - 1)(rng)];
+	};
+	std::string body;
+	std::string closers;
+	auto length = std::uniform_int_distribution<int>(1, 5)(rng);
+	for (int i = 0; i < length; ++i) {
+		std::string_view token;
+		switch (std::uniform_int_distribution<int>(0, 9)(rng)) {
+			case 0: case 1: case 2: token = pick(atoms); break;
+			case 3: case 4: case 5: token = pick(operators); break;
+			case 6: case 7: case 8: token = pick(openers); break;
+			default: token = pick(others); break;
+		}
+		body += token;
+		body += ' ';
+		switch (token.back()) {
+			case '(': closers.insert(0, ")"); break;
+			case '[': closers.insert(0, "]"); break;
+			case '=': closers.insert(0, "}"); break;
+			case ')': case ']': case '}':
+				if (!closers.empty() && closers[0] == token.back()) closers.erase(0, 1);
+				break;
+		}
+	}
+	std::string pattern = "$" + body + "$a";
+	if (!closers.empty()) pattern += "$" + closers + "$";
+	return pattern;
+}
+
+}
+
+}
+
+int main(int argc, char * * argv) {
+	std::size_t iterations = 1000;
+	std::uint64_t seed = std::random_device{}();
+	std::string save;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (arg.substr(0, 13) == "--iterations=") {
+			iterations = std::stoull(std::string(arg.substr(13)));
+		} else if (arg.substr(0, 7) == "--seed=") {
+			seed = std::stoull(std::string(arg.substr(7)));
+		} else if (arg.substr(0, 7) == "--save=") {
+			save = arg.substr(7);
+		} else if (arg[0] == '-') {
+			std::clog << "Usage: " << argv[0] << " [--iterations=N] [--seed=N] [--save=directory] [pattern-file...]" << std::endl;
+			return 1;
+		} else {
+			files.emplace_back(arg);
+		}
+	}
+
+	if (!files.empty()) {
+		bool ok = true;
+		for (auto const & file : files) {
+			std::ifstream in(file, std::ios::binary);
+			if (!in) {
+				std::cerr << file << ": unable to open file" << std::endl;
+				return 1;
+			}
+			std::string pattern(std::istreambuf_iterator<char>(in), {});
+			if (!pattern.empty() && pattern.back() == '\n') pattern.pop_back();
+			auto g = conftaal::growth(pattern);
+			conftaal::print(file, g);
+			ok &= !g.super_linear();
+		}
+		return ok ? 0 : 1;
+	}
+
+	std::cout << "seed " << seed << std::endl;
+	std::mt19937_64 rng(seed);
+	std::set<std::string> found;
+	for (std::size_t i = 0; i < iterations; ++i) {
+		auto pattern = conftaal::random_pattern(rng);
+		if (found.count(pattern)) continue;
+		auto g = conftaal::growth(pattern);
+		if (!g.super_linear()) continue;
+		found.insert(pattern);
+		conftaal::print(pattern, g);
+		if (!save.empty()) {
+			auto file = save + "/found-" + std::to_string(seed) + "-" + std::to_string(found.size());
+			std::ofstream(file, std::ios::binary) << pattern << '\n';
+			std::cout << "saved as " << file << std::endl;
+		}
+	}
+	std::cout << found.size() << " super-linear pattern(s) in " << iterations << " tries" << std::endl;
+	return found.empty() ? 0 : 1;
+}
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "error.hpp"
+#include "format.hpp"
+#include "incremental.hpp"
+
+namespace conftaal {
+
+IncrementalEvaluator::IncrementalEvaluator(ObjectExpression const & root) {
+	add_object(root, npos, "");
+	// Only link the fields once all of them exist, as they can refer to
+	// fields that come after them.
+	for (std::size_t f = 0; f < fields_.size(); ++f) {
+		link(f);
+		fields_[f].dirty = true;
+		dirty_.push_back(f);
+	}
+	update();
+}
+
+std::size_t IncrementalEvaluator::find(string_view path) const {
+	auto i = by_name_.find(path);
+	return i == by_name_.end() ? npos : i->second;
+}
+
+auto IncrementalEvaluator::add(
+	refcount_ptr<Expression const> const & value, std::size_t parent, std::size_t scope, std::string name
+) -> Entry {
+	if (auto object = dynamic_cast<ObjectExpression const *>(value.get())) {
+		return {true, add_object(*object, parent, std::move(name))};
+	}
+	if (auto list = dynamic_cast<ListExpression const *>(value.get())) {
+		std::size_t index = containers_.size();
+		containers_.push_back({false, parent, name, {}, {}});
+		for (std::size_t i = 0; i < list->elements.size(); ++i) {
+			auto entry = add(list->elements[i], index, scope, name + "[" + std::to_string(i) + "]");
+			containers_[index].elements.push_back(entry);
+		}
+		return {true, index};
+	}
+	std::size_t index = fields_.size();
+	by_name_[name] = index;
+	fields_.emplace_back();
+	fields_.back().name = std::move(name);
+	fields_.back().scope = scope;
+	fields_.back().expression = value;
+	return {false, index};
+}
+
+std::size_t IncrementalEvaluator::add_object(ObjectExpression const & object, std::size_t parent, std::string name) {
+	std::size_t index = containers_.size();
+	containers_.push_back({true, parent, name, {}, {}});
+	auto const & keys = object.keys->elements;
+	auto const & values = object.values->elements;
+	for (std::size_t i = 0; i < keys.size(); ++i) {
+		auto key = static_cast<StringLiteralExpression const &>(*keys[i]).value();
+		auto entry = add(values[i], index, index, name.empty() ? std::string(key) : name + "." + std::string(key));
+		containers_[index].keys[std::string(key)] = entry;
+	}
+	return index;
+}
+
+void IncrementalEvaluator::set(std::size_t field, refcount_ptr<Expression const> expression) {
+	unlink(field);
+	fields_[field].expression = std::move(expression);
+	link(field);
+	if (!fields_[field].dirty) {
+		fields_[field].dirty = true;
+		dirty_.push_back(field);
+	}
+}
+
+void IncrementalEvaluator::set(ObjectExpression const & changes) {
+	auto const & keys = changes.keys->elements;
+	auto const & values = changes.values->elements;
+	for (std::size_t i = 0; i < keys.size(); ++i) {
+		auto key = static_cast<StringLiteralExpression const &>(*keys[i]).value();
+		auto entry = containers_[0].keys.find(key);
+		if (entry == containers_[0].keys.end()) throw Error("unknown field `" + std::string(key) + "'", key);
+		set(entry->second, values[i], key);
+	}
+}
+
+void IncrementalEvaluator::set(Entry target, refcount_ptr<Expression const> const & change, string_view where) {
+	if (!target.container) {
+		auto const & field = fields_[target.index];
+		if (dynamic_cast<ObjectExpression const *>(change.get()) || dynamic_cast<ListExpression const *>(change.get())) {
+			throw Error("`" + field.name + "' is not an object or list", where);
+		}
+		set(target.index, change);
+		return;
+	}
+	auto const & container = containers_[target.index];
+	if (container.object) {
+		auto object = dynamic_cast<ObjectExpression const *>(change.get());
+		if (!object) throw Error("`" + container.name + "' is an object", where);
+		auto const & keys = object->keys->elements;
+		auto const & values = object->values->elements;
+		for (std::size_t i = 0; i < keys.size(); ++i) {
+			auto key = static_cast<StringLiteralExpression const &>(*keys[i]).value();
+			auto entry = container.keys.find(key);
+			if (entry == container.keys.end()) throw Error(
+				"unknown field `" + container.name + "." + std::string(key) + "'",
+				key
+			);
+			set(entry->second, values[i], key);
+		}
+	} else {
+		auto list = dynamic_cast<ListExpression const *>(change.get());
+		if (!list) throw Error("`" + container.name + "' is a list", where);
+		if (list->elements.size() != container.elements.size()) throw Error(
+			"`" + container.name + "' has " + std::to_string(container.elements.size()) + " elements",
+			where
+		);
+		for (std::size_t i = 0; i < list->elements.size(); ++i) {
+			set(container.elements[i], list->elements[i], where);
+		}
+	}
+}
+
+auto IncrementalEvaluator::lookup(Expression const & reference, std::size_t scope) const -> Entry const * {
+	if (auto id = dynamic_cast<IdentifierExpression const *>(&reference)) {
+		for (auto c = scope; c != npos; c = containers_[c].parent) {
+			auto const & container = containers_[c];
+			if (!container.object) continue;
+			auto entry = container.keys.find(id->identifier);
+			if (entry != container.keys.end()) return &entry->second;
+		}
+		return nullptr;
+	}
+	auto e = dynamic_cast<OperatorExpression const *>(&reference);
+	if (!e || e->is_unary()) return nullptr;
+	if (e->op == Operator::dot) {
+		auto base = lookup(*e->lhs, scope);
+		auto name = dynamic_cast<IdentifierExpression const *>(e->rhs.get());
+		if (!base || !base->container || !name) return nullptr;
+		auto const & container = containers_[base->index];
+		if (!container.object) return nullptr;
+		auto entry = container.keys.find(name->identifier);
+		return entry == container.keys.end() ? nullptr : &entry->second;
+	}
+	if (e->op == Operator::index) {
+		auto base = lookup(*e->lhs, scope);
+		auto index = dynamic_cast<ListExpression const *>(e->rhs.get());
+		if (!base || !base->container || !index || index->elements.size() != 1) return nullptr;
+		auto const & container = containers_[base->index];
+		auto i = dynamic_cast<IntegerLiteralExpression const *>(index->elements[0].get());
+		if (container.object || !i || i->value < 0 || std::size_t(i->value) >= container.elements.size()) return nullptr;
+		return &container.elements[i->value];
+	}
+	return nullptr;
+}
+
+void IncrementalEvaluator::collect_references(Field & field, Expression const & expr) {
+	auto e = dynamic_cast<OperatorExpression const *>(&expr);
+	bool is_reference =
+		dynamic_cast<IdentifierExpression const *>(&expr) ||
+		(e && (e->op == Operator::dot || e->op == Operator::index));
+	if (is_reference) {
+		auto entry = lookup(expr, field.scope);
+		if (!entry || entry->container) {
+			if (field.reference_error.empty()) {
+				field.reference_error = !entry
+					? "unknown field `" + format(expr) + "'"
+					: "`" + format(expr) + "' is not a number";
+			}
+			return;
+		}
+		auto & deps = field.dependencies;
+		auto i = std::find(deps.begin(), deps.end(), entry->index) - deps.begin();
+		if (std::size_t(i) == deps.size()) deps.push_back(entry->index);
+		field.inputs[&expr] = i;
+	} else if (e) {
+		if (e->lhs) collect_references(field, *e->lhs);
+		collect_references(field, *e->rhs);
+	}
+}
+
+void IncrementalEvaluator::link(std::size_t f) {
+	auto & field = fields_[f];
+	collect_references(field, *field.expression);
+	for (auto d : field.dependencies) fields_[d].dependents.push_back(f);
+}
+
+void IncrementalEvaluator::unlink(std::size_t f) {
+	auto & field = fields_[f];
+	for (auto d : field.dependencies) {
+		auto & dependents = fields_[d].dependents;
+		dependents.erase(std::find(dependents.begin(), dependents.end(), f));
+	}
+	field.dependencies.clear();
+	field.inputs.clear();
+	field.reference_error.clear();
+	field.compiled = false;
+}
+
+std::vector<std::size_t> IncrementalEvaluator::update() {
+	++epoch_;
+	evaluated_ = 0;
+
+	// The fields that might change: the ones that were set, and everything
+	// that (indirectly) depends on those.
+	std::vector<std::size_t> affected;
+	auto mark = [&] (std::size_t f) {
+		if (fields_[f].epoch == epoch_) return;
+		fields_[f].epoch = epoch_;
+		fields_[f].pending = 0;
+		affected.push_back(f);
+	};
+	for (auto f : dirty_) mark(f);
+	dirty_.clear();
+	for (std::size_t i = 0; i < affected.size(); ++i) {
+		for (auto d : fields_[affected[i]].dependents) mark(d);
+	}
+
+	// Evaluate them in topological order: every field after its
+	// dependencies.
+	std::vector<std::size_t> ready;
+	for (auto f : affected) {
+		for (auto d : fields_[f].dependencies) {
+			if (fields_[d].epoch == epoch_) ++fields_[f].pending;
+		}
+		if (fields_[f].pending == 0) ready.push_back(f);
+	}
+
+	std::vector<std::size_t> changed;
+	for (std::size_t i = 0; i < ready.size(); ++i) {
+		auto f = ready[i];
+		auto & field = fields_[f];
+		if (field.dirty || field.stale) {
+			++evaluated_;
+			auto value = evaluate(field);
+			if (value != field.value) {
+				field.value = std::move(value);
+				changed.push_back(f);
+				for (auto d : field.dependents) fields_[d].stale = true;
+			}
+		}
+		field.dirty = false;
+		field.stale = false;
+		for (auto d : field.dependents) {
+			if (fields_[d].epoch == epoch_ && --fields_[d].pending == 0) ready.push_back(d);
+		}
+	}
+
+	// The ones that never got ready are in or behind a cycle.
+	for (auto f : affected) {
+		auto & field = fields_[f];
+		if (field.pending == 0) continue;
+		FieldValue value;
+		value.error = "circular reference";
+		if (value != field.value) {
+			field.value = std::move(value);
+			changed.push_back(f);
+		}
+		field.dirty = false;
+		field.stale = false;
+	}
+
+	return changed;
+}
+
+FieldValue IncrementalEvaluator::evaluate(Field & field) {
+	FieldValue result;
+	if (!field.reference_error.empty()) {
+		result.error = field.reference_error;
+		return result;
+	}
+
+	std::vector<std::int64_t> inputs;
+	std::vector<NumericType> types;
+	for (auto d : field.dependencies) {
+		auto const & v = fields_[d].value;
+		if (v.state == FieldValue::State::error) {
+			result.error = "`" + fields_[d].name + "' has no numeric value";
+			return result;
+		}
+		if (v.state == FieldValue::State::failed) {
+			result.state = FieldValue::State::failed;
+			return result;
+		}
+		inputs.push_back(v.bits);
+		types.push_back(v.type);
+	}
+
+	if (!field.compiled || types != field.input_types) {
+		field.compiled = true;
+		field.input_types = types;
+		field.nodes.clear();
+		field.compile_error.clear();
+		try {
+			field.nodes = compile_numeric(*field.expression, types, [&] (Expression const & e) {
+				auto i = field.inputs.find(&e);
+				return i == field.inputs.end() ? no_input : i->second;
+			});
+		} catch (Error & e) {
+			field.compile_error = e.what();
+		}
+	}
+	if (!field.compile_error.empty()) {
+		result.error = field.compile_error;
+		return result;
+	}
+
+	std::uint8_t failed = 0;
+	auto bits = interpret(field.nodes, field.nodes.size() - 1, inputs.data(), failed);
+	result.type = field.nodes.back().type;
+	if (failed) {
+		result.state = FieldValue::State::failed;
+	} else {
+		result.state = FieldValue::State::value;
+		result.bits = bits;
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "expression.hpp"
+#include "numeric.hpp"
+
+namespace conftaal {
+
+// The value of a field, as evaluated by IncrementalEvaluator.
+struct FieldValue {
+	enum class State {
+		value,
+		// Evaluation failed, like on a division by zero (see numeric.hpp).
+		failed,
+		// Not a numeric expression, or it refers to something that isn't.
+		error,
+	};
+
+	State state = State::error;
+	NumericType type = NumericType::integer;
+	std::int64_t bits = 0; // The bits of a floating point number.
+	std::string error;
+
+	bool operator==(FieldValue const & other) const {
+		return state == other.state && type == other.type && bits == other.bits && error == other.error;
+	}
+	bool operator!=(FieldValue const & other) const { return !(*this == other); }
+};
+
+// Evaluates the numeric fields of a configuration that are computed from
+// other fields, like `{ cores = 8, threads = cores * 2 }', and keeps them
+// up to date when fields change.
+//
+// The fields are all values in the tree of objects and lists, named by
+// their path (see Path), like `limits.cpu' or `ports[0]'. A field refers to
+// others through identifiers, looked up in the objects around it from the
+// inside out, followed by any number of `.name' and `[n]', like
+// `servers.primary.ports[0]'.
+//
+// These references form a dependency graph. After changing fields, only
+// the fields that (indirectly) depend on them are evaluated again, and
+// of those, only the ones for which a dependency actually got a different
+// value. Fields in a cycle of references, and all fields depending on
+// those, get an error.
+class IncrementalEvaluator {
+public:
+	// Evaluates all fields of the object.
+	explicit IncrementalEvaluator(ObjectExpression const & root);
+
+	std::size_t size() const { return fields_.size(); }
+
+	// The index of the field with this path, or npos.
+	std::size_t find(std::string_view path) const;
+
+	static constexpr std::size_t npos = -1;
+
+	std::string const & name(std::size_t field) const { return fields_[field].name; }
+	FieldValue const & value(std::size_t field) const { return fields_[field].value; }
+
+	// Replaces the expression of a field, to be evaluated by update().
+	void set(std::size_t field, refcount_ptr<Expression const>);
+
+	// Sets all fields in a tree of changes with the same shape, like
+	// `{ limits = { cpu = 4 } }'. Throws an Error if it doesn't match the
+	// fields.
+	void set(ObjectExpression const & changes);
+
+	// Evaluates the fields that depend on the ones set since the last
+	// update. Returns the fields whose value changed, in the order in which
+	// they were evaluated.
+	std::vector<std::size_t> update();
+
+	// The number of fields evaluated by the last update.
+	std::size_t evaluated() const { return evaluated_; }
+
+private:
+	// A reference to an object or list, or to a field.
+	struct Entry {
+		bool container;
+		std::size_t index;
+	};
+
+	struct Container {
+		bool object;
+		std::size_t parent; // npos for the root.
+		std::string name;
+		std::map<std::string, Entry, std::less<>> keys; // The last one, for duplicate keys.
+		std::vector<Entry> elements;
+	};
+
+	struct Field {
+		std::string name;
+		std::size_t scope; // The innermost object around it.
+		refcount_ptr<Expression const> expression;
+
+		// From resolving the references in the expression.
+		std::vector<std::size_t> dependencies;
+		std::map<Expression const *, std::size_t> inputs; // Index in dependencies.
+		std::string reference_error;
+
+		// Compiled for the types the dependencies had at that time.
+		std::vector<NumericNode> nodes;
+		std::vector<NumericType> input_types;
+		std::string compile_error;
+		bool compiled = false;
+
+		std::vector<std::size_t> dependents;
+		FieldValue value;
+
+		// Set by set(), to be evaluated by update().
+		bool dirty = false;
+		// A dependency got a different value during this update.
+		bool stale = false;
+		// This field might change during the update with this epoch.
+		std::size_t epoch = 0;
+		// Dependencies still to be evaluated during this update.
+		std::size_t pending = 0;
+	};
+
+	std::vector<Container> containers_;
+	std::vector<Field> fields_;
+	std::map<std::string, std::size_t, std::less<>> by_name_;
+	std::vector<std::size_t> dirty_;
+	std::size_t evaluated_ = 0;
+	std::size_t epoch_ = 0;
+
+	Entry add(refcount_ptr<Expression const> const & value, std::size_t parent, std::size_t scope, std::string name);
+	std::size_t add_object(ObjectExpression const &, std::size_t parent, std::string name);
+	void set(Entry, refcount_ptr<Expression const> const & change, string_view where);
+	Entry const * lookup(Expression const & reference, std::size_t scope) const;
+	void collect_references(Field &, Expression const &);
+	void link(std::size_t field);
+	void unlink(std::size_t field);
+	FieldValue evaluate(Field &);
+};
+
+}
@@ -0,0 +1,311 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "jit.hpp"
+
+namespace conftaal {
+
+namespace {
+
+#if defined(__x86_64__)
+
+std::int64_t apply_integer(NumericNode const * node, std::int64_t a, std::int64_t b, std::uint8_t * failed) {
+	return apply_binary(*node, NumericType::integer, a, b, *failed);
+}
+
+std::int64_t apply_floating(NumericNode const * node, std::int64_t a, std::int64_t b, std::uint8_t * failed) {
+	return apply_binary(*node, NumericType::floating, a, b, *failed);
+}
+
+// Generates code for the System V calling convention.
+//
+// The inputs pointer is kept in rbx and the failed pointer in r12. Every
+// node leaves its value in rax, with floating point numbers as their bits.
+// The left hand side of a binary operator is kept on the stack while
+// evaluating the right hand side. Operators without a few instructions
+// equivalent, like division, call apply_binary().
+class CodeGenerator {
+public:
+	explicit CodeGenerator(std::vector<NumericNode> const & nodes) : nodes_(nodes) {}
+
+	std::vector<std::uint8_t> generate() {
+		emit({0x53});                   // push rbx
+		emit({0x41, 0x54});             // push r12
+		emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+		emit({0x48, 0x89, 0xFB});       // mov rbx, rdi
+		emit({0x49, 0x89, 0xF4});       // mov r12, rsi
+		node(nodes_.size() - 1, nodes_.back().type);
+		emit({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+		emit({0x41, 0x5C});             // pop r12
+		emit({0x5B});                   // pop rbx
+		emit({0xC3});                   // ret
+		return std::move(code_);
+	}
+
+private:
+	std::vector<NumericNode> const & nodes_;
+	std::vector<std::uint8_t> code_;
+
+	// The number of values pushed, to keep calls 16-byte aligned.
+	std::size_t depth_ = 0;
+
+	void emit(std::initializer_list<std::uint8_t> bytes) {
+		code_.insert(code_.end(), bytes);
+	}
+
+	template<typename T>
+	void emit_value(T v) {
+		std::uint8_t bytes[sizeof(T)];
+		std::memcpy(bytes, &v, sizeof(T));
+		code_.insert(code_.end(), bytes, bytes + sizeof(T));
+	}
+
+	// Emits a jump with the given opcode, and returns where to patch in the
+	// target.
+	std::size_t jump(std::initializer_list<std::uint8_t> opcode) {
+		emit(opcode);
+		emit_value(std::int32_t(0));
+		return code_.size();
+	}
+
+	void land(std::size_t jump) {
+		std::int32_t offset = code_.size() - jump;
+		std::memcpy(&code_[jump - 4], &offset, 4);
+	}
+
+	void push() { emit({0x50}); ++depth_; }
+	void pop_rcx() { emit({0x59}); --depth_; }
+
+	void to_floating() {
+		emit({0xF2, 0x48, 0x0F, 0x2A, 0xC0}); // cvtsi2sd xmm0, rax
+		emit({0x66, 0x48, 0x0F, 0x7E, 0xC0}); // movq rax, xmm0
+	}
+
+	void operands_to_xmm() {
+		emit({0x66, 0x48, 0x0F, 0x6E, 0xC0}); // movq xmm0, rax
+		emit({0x66, 0x48, 0x0F, 0x6E, 0xC9}); // movq xmm1, rcx
+	}
+
+	// Sets al from the flags with the given setcc opcode.
+	void set(std::uint8_t opcode) {
+		emit({0x0F, opcode, 0xC0});
+	}
+
+	// Sets al for whether xmm0 equals xmm1 or not, taking care of NaN.
+	void set_floating_equal(bool equal) {
+		emit({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+		if (equal) {
+			set(0x94);                  // sete al
+			emit({0x0F, 0x9B, 0xC1});   // setnp cl
+			emit({0x20, 0xC8});         // and al, cl
+		} else {
+			set(0x95);                  // setne al
+			emit({0x0F, 0x9A, 0xC1});   // setp cl
+			emit({0x08, 0xC8});         // or al, cl
+		}
+	}
+
+	void zero_extend_al() {
+		emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+	}
+
+	// Replaces rax by 0 or 1.
+	void to_bool(NumericType type) {
+		if (type == NumericType::integer) {
+			emit({0x48, 0x85, 0xC0});             // test rax, rax
+			set(0x95);                            // setne al
+		} else {
+			emit({0x66, 0x0F, 0x57, 0xC9});       // xorpd xmm1, xmm1
+			emit({0x66, 0x48, 0x0F, 0x6E, 0xC0}); // movq xmm0, rax
+			set_floating_equal(false);
+		}
+		zero_extend_al();
+	}
+
+	void call(NumericNode const & n, NumericType operand_type) {
+		auto f = operand_type == NumericType::integer ? &apply_integer : &apply_floating;
+		emit({0x48, 0x89, 0xCA});       // mov rdx, rcx
+		emit({0x48, 0x89, 0xC6});       // mov rsi, rax
+		emit({0x4C, 0x89, 0xE1});       // mov rcx, r12
+		emit({0x48, 0xBF});             // mov rdi, imm64
+		emit_value(&n);
+		emit({0x48, 0xB8});             // mov rax, imm64
+		emit_value(f);
+		bool pad = depth_ % 2;
+		if (pad) emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+		emit({0xFF, 0xD0});             // call rax
+		if (pad) emit({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+	}
+
+	// Leaves the value of the node in rax, converted to the given type.
+	void node(std::size_t index, NumericType type) {
+		auto const & n = nodes_[index];
+		switch (n.kind) {
+			case NumericNode::Kind::input:
+				emit({0x48, 0x8B, 0x83}); // mov rax, [rbx + disp32]
+				emit_value(std::int32_t(n.rhs * 8));
+				break;
+			case NumericNode::Kind::constant:
+				emit({0x48, 0xB8});       // mov rax, imm64
+				emit_value(n.type == NumericType::integer ? n.integer : to_bits(n.floating));
+				break;
+			case NumericNode::Kind::unary:
+				unary(n);
+				break;
+			case NumericNode::Kind::binary:
+				if (n.op == Operator::logical_and || n.op == Operator::logical_or) {
+					logical(n);
+				} else {
+					binary(n);
+				}
+				break;
+		}
+		if (type == NumericType::floating && n.type == NumericType::integer) to_floating();
+	}
+
+	void unary(NumericNode const & n) {
+		auto type = nodes_[n.rhs].type;
+		node(n.rhs, type);
+		switch (n.op) {
+			case Operator::logical_not:
+				to_bool(type);
+				emit({0x83, 0xF0, 0x01});             // xor eax, 1
+				break;
+			case Operator::complement:
+				emit({0x48, 0xF7, 0xD0});             // not rax
+				break;
+			case Operator::unary_minus:
+				if (type == NumericType::integer) {
+					emit({0x48, 0xF7, 0xD8});         // neg rax
+				} else {
+					emit({0x48, 0xB9});               // mov rcx, imm64
+					emit_value(std::uint64_t(1) << 63);
+					emit({0x48, 0x31, 0xC8});         // xor rax, rcx
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	void logical(NumericNode const & n) {
+		bool is_and = n.op == Operator::logical_and;
+		node(n.lhs, nodes_[n.lhs].type);
+		to_bool(nodes_[n.lhs].type);
+		// If the left hand side decides the result, rax already holds it.
+		auto done = jump({0x0F, std::uint8_t(is_and ? 0x84 : 0x85)}); // jz or jnz rel32
+		node(n.rhs, nodes_[n.rhs].type);
+		to_bool(nodes_[n.rhs].type);
+		land(done);
+	}
+
+	void binary(NumericNode const & n) {
+		auto type =
+			nodes_[n.lhs].type == NumericType::integer && nodes_[n.rhs].type == NumericType::integer
+			? NumericType::integer : NumericType::floating;
+		node(n.lhs, type);
+		push();
+		node(n.rhs, type);
+		emit({0x48, 0x89, 0xC1}); // mov rcx, rax
+		emit({0x58});             // pop rax
+		--depth_;
+
+		if (type == NumericType::integer) {
+			switch (n.op) {
+				case Operator::plus:    emit({0x48, 0x01, 0xC8}); return;       // add rax, rcx
+				case Operator::minus:   emit({0x48, 0x29, 0xC8}); return;       // sub rax, rcx
+				case Operator::times:   emit({0x48, 0x0F, 0xAF, 0xC1}); return; // imul rax, rcx
+				case Operator::bit_and: emit({0x48, 0x21, 0xC8}); return;       // and rax, rcx
+				case Operator::bit_or:  emit({0x48, 0x09, 0xC8}); return;       // or rax, rcx
+				case Operator::bit_xor: emit({0x48, 0x31, 0xC8}); return;       // xor rax, rcx
+				default: break;
+			}
+			if (is_comparison(n.op)) {
+				emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+				switch (n.op) {
+					case Operator::equal:            set(0x94); break; // sete
+					case Operator::inequal:          set(0x95); break; // setne
+					case Operator::greater:          set(0x9F); break; // setg
+					case Operator::less:             set(0x9C); break; // setl
+					case Operator::greater_or_equal: set(0x9D); break; // setge
+					default:                         set(0x9E); break; // setle
+				}
+				zero_extend_al();
+				return;
+			}
+		} else {
+			std::uint8_t arithmetic = 0;
+			switch (n.op) {
+				case Operator::plus:   arithmetic = 0x58; break; // addsd
+				case Operator::minus:  arithmetic = 0x5C; break; // subsd
+				case Operator::times:  arithmetic = 0x59; break; // mulsd
+				case Operator::divide: arithmetic = 0x5E; break; // divsd
+				default: break;
+			}
+			if (arithmetic) {
+				operands_to_xmm();
+				emit({0xF2, 0x0F, arithmetic, 0xC1});  // op xmm0, xmm1
+				emit({0x66, 0x48, 0x0F, 0x7E, 0xC0});  // movq rax, xmm0
+				return;
+			}
+			if (is_comparison(n.op)) {
+				operands_to_xmm();
+				switch (n.op) {
+					case Operator::equal:   set_floating_equal(true); break;
+					case Operator::inequal: set_floating_equal(false); break;
+					// Unordered comparisons set the carry flag, so `above'
+					// and `above or equal' are false for NaN.
+					case Operator::greater:
+					case Operator::greater_or_equal:
+						emit({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+						set(n.op == Operator::greater ? 0x97 : 0x93); // seta or setae
+						break;
+					default:
+						emit({0x66, 0x0F, 0x2E, 0xC8}); // ucomisd xmm1, xmm0
+						set(n.op == Operator::less ? 0x97 : 0x93); // seta or setae
+						break;
+				}
+				zero_extend_al();
+				return;
+			}
+		}
+
+		call(n, type);
+	}
+};
+
+#endif
+
+}
+
+CompiledExpression::CompiledExpression(Expression const & expr, NumericInputs const & inputs)
+	: nodes_(compile_numeric(expr, inputs)) {
+#if defined(__x86_64__)
+	auto code = CodeGenerator(nodes_).generate();
+	std::size_t page = sysconf(_SC_PAGESIZE);
+	std::size_t size = (code.size() + page - 1) / page * page;
+	void * mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) return;
+	std::memcpy(mapping, code.data(), code.size());
+	// Never writable and executable at the same time.
+	if (mprotect(mapping, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mapping, size);
+		return;
+	}
+	mapping_ = mapping;
+	mapping_size_ = size;
+	code_ = reinterpret_cast<Function>(mapping);
+#endif
+}
+
+CompiledExpression::~CompiledExpression() {
+	if (mapping_) munmap(mapping_, mapping_size_);
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "expression.hpp"
+#include "numeric.hpp"
+
+namespace conftaal {
+
+// A numeric expression compiled to machine code, to evaluate it for one
+// row of inputs at a time. See numeric.hpp for the semantics.
+//
+// Native code is only generated on x86-64, and only when the system allows
+// mapping executable memory. Otherwise, evaluate() walks the tree instead.
+class CompiledExpression {
+public:
+	// Every identifier in the expression must be one of the named inputs.
+	// Throws an Error pointing at the first unsupported subexpression.
+	CompiledExpression(Expression const & expr, NumericInputs const & inputs);
+
+	CompiledExpression(CompiledExpression const &) = delete;
+	CompiledExpression & operator=(CompiledExpression const &) = delete;
+
+	~CompiledExpression();
+
+	NumericType result_type() const { return nodes_.back().type; }
+
+	bool is_native() const { return code_ != nullptr; }
+
+	// The inputs are in the same order as given to the constructor, as
+	// integers, or as the bits of floating point numbers (see to_bits).
+	// The result is returned the same way.
+	//
+	// Sets 'failed' to 1 if evaluation failed, in which case the result is
+	// unspecified. Does not reset it otherwise.
+	std::int64_t evaluate(std::int64_t const * inputs, std::uint8_t & failed) const {
+		if (code_) return code_(inputs, &failed);
+		return interpret(inputs, failed);
+	}
+
+	// Evaluates by walking the tree, even if native code is available.
+	std::int64_t interpret(std::int64_t const * inputs, std::uint8_t & failed) const {
+		return conftaal::interpret(nodes_, nodes_.size() - 1, inputs, failed);
+	}
+
+private:
+	using Function = std::int64_t (*)(std::int64_t const * inputs, std::uint8_t * failed);
+
+	std::vector<NumericNode> nodes_;
+	Function code_ = nullptr;
+	void * mapping_ = nullptr;
+	std::size_t mapping_size_ = 0;
+};
+
+}
@@ -0,0 +1,439 @@
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "escape.hpp"
+#include "json.hpp"
+#include "utf8.hpp"
+
+namespace conftaal {
+
+namespace {
+
+// Bit i of a mask is set if byte i of the block is one of those.
+struct Block {
+	std::uint64_t quote = 0;
+	std::uint64_t backslash = 0;
+	std::uint64_t structural = 0; // { } [ ] : ,
+	std::uint64_t space = 0;
+	std::uint64_t control = 0;
+};
+
+Block classify(unsigned char const * p) {
+	Block b;
+#ifdef __SSE2__
+	__m128i const max_control = _mm_set1_epi8(0x1F);
+	for (int k = 0; k < 4; ++k) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 16 * k));
+		auto is = [&] (char c) { return _mm_cmpeq_epi8(x, _mm_set1_epi8(c)); };
+		auto bits = [&] (__m128i m) { return std::uint64_t(std::uint16_t(_mm_movemask_epi8(m))) << 16 * k; };
+		// Setting bit 5 turns `[' and `]' into `{' and `}'.
+		__m128i folded = _mm_or_si128(x, _mm_set1_epi8(0x20));
+		b.quote |= bits(is('"'));
+		b.backslash |= bits(is('\\'));
+		b.structural |= bits(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+			_mm_or_si128(is(':'), is(','))
+		));
+		b.space |= bits(_mm_or_si128(_mm_or_si128(is(' '), is('\t')), _mm_or_si128(is('\n'), is('\r'))));
+		b.control |= bits(_mm_cmpeq_epi8(_mm_max_epu8(x, max_control), max_control));
+	}
+#else
+	for (int i = 0; i < 64; ++i) {
+		std::uint64_t bit = std::uint64_t(1) << i;
+		switch (p[i]) {
+			case '"': b.quote |= bit; break;
+			case '\\': b.backslash |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',': b.structural |= bit; break;
+			case ' ': case '\t': case '\n': case '\r': b.space |= bit; break;
+		}
+		if (p[i] < 0x20) b.control |= bit;
+	}
+#endif
+	return b;
+}
+
+// The bytes that are escaped by a backslash. Bit 0 of carry is set if the
+// first byte of the block is escaped by the last byte of the previous one.
+std::uint64_t escaped_bytes(std::uint64_t backslash, std::uint64_t & carry) {
+	std::uint64_t escaped = carry;
+	carry = 0;
+	// Backslashes are rare, so just go through them one by one.
+	while (backslash) {
+		int i = __builtin_ctzll(backslash);
+		backslash &= backslash - 1;
+		if (escaped >> i & 1) continue;
+		if (i == 63) {
+			carry = 1;
+		} else {
+			escaped |= std::uint64_t(2) << i;
+		}
+	}
+	return escaped;
+}
+
+// Bit i of the result is the xor of bits 0 through i.
+std::uint64_t prefix_xor(std::uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+// The offsets of the structural characters outside of strings, of the
+// quotes around strings, and of the first byte of every other value.
+std::vector<std::uint32_t> structural_index(string_view source) {
+	std::vector<std::uint32_t> index;
+	auto const data = reinterpret_cast<unsigned char const *>(source.data());
+	std::uint64_t escape_carry = 0;
+	std::uint64_t string_carry = 0;
+	std::uint64_t value_carry = 0;
+	for (std::size_t offset = 0; offset < source.size(); offset += 64) {
+		unsigned char padded[64];
+		auto p = data + offset;
+		if (source.size() - offset < 64) {
+			std::memset(padded, ' ', 64);
+			std::memcpy(padded, p, source.size() - offset);
+			p = padded;
+		}
+		auto b = classify(p);
+		auto quote = b.quote & ~escaped_bytes(b.backslash, escape_carry);
+		// From an opening quote up to, but not including, its closing quote.
+		auto in_string = prefix_xor(quote) ^ string_carry;
+		string_carry = std::uint64_t(std::int64_t(in_string) >> 63);
+		if (auto c = b.control & in_string) throw ParseError(
+			"control character in string literal",
+			source.substr(offset + __builtin_ctzll(c), 1)
+		);
+		auto value = ~(b.structural | b.space | quote | in_string);
+		auto value_start = value & ~(value << 1 | value_carry);
+		value_carry = value >> 63;
+		auto bits = (b.structural & ~in_string) | quote | value_start;
+		auto n = index.size();
+		index.resize(n + __builtin_popcountll(bits));
+		for (auto out = index.data() + n; bits; bits &= bits - 1) {
+			*out++ = offset + __builtin_ctzll(bits);
+		}
+	}
+	return index;
+}
+
+bool is_value_byte(char c) {
+	switch (c) {
+		case '{': case '}': case '[': case ']': case ':': case ',':
+		case ' ': case '\t': case '\n': case '\r': case '"':
+			return false;
+		default:
+			return true;
+	}
+}
+
+char32_t parse_hex4(string_view source) {
+	if (source.size() < 4) throw ParseError("incomplete escape sequence", source);
+	char32_t value = 0;
+	for (int i = 0; i < 4; ++i) {
+		int digit = digit_value(source[i]);
+		if (digit == -1) throw ParseError("expected hexadecimal digit (0-9, a-f, A-F)", source.substr(i, 0));
+		value = value << 4 | digit;
+	}
+	return value;
+}
+
+std::string decode_json_string(string_view source) {
+	std::string out;
+	out.reserve(source.size());
+	while (true) {
+		auto backslash = source.find('\\');
+		out.append(source.substr(0, backslash));
+		if (backslash == string_view::npos) break;
+		source.remove_prefix(backslash);
+		char replacement;
+		switch (source[1]) {
+			case '"': replacement = '"'; break;
+			case '\\': replacement = '\\'; break;
+			case '/': replacement = '/'; break;
+			case 'b': replacement = '\b'; break;
+			case 'f': replacement = '\f'; break;
+			case 'n': replacement = '\n'; break;
+			case 'r': replacement = '\r'; break;
+			case 't': replacement = '\t'; break;
+			case 'u': {
+				char32_t codepoint = parse_hex4(source.substr(2));
+				std::size_t length = 6;
+				// Codepoints above U+FFFF are written as a pair of surrogates.
+				if (codepoint >= 0xD800 && codepoint <= 0xDBFF && source.substr(6, 2) == "\\u") {
+					char32_t low = parse_hex4(source.substr(8));
+					if (low >= 0xDC00 && low <= 0xDFFF) {
+						codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+						length = 12;
+					}
+				}
+				char buffer[4];
+				auto n = encode_utf8(codepoint, buffer);
+				if (!n) throw ParseError("invalid unicode codepoint", source.substr(0, length));
+				out.append(buffer, n);
+				source.remove_prefix(length);
+				continue;
+			}
+			default:
+				throw ParseError("invalid escape sequence", source.substr(0, 2));
+		}
+		out += replacement;
+		source.remove_prefix(2);
+	}
+	return out;
+}
+
+// Builds the tree from the structural index.
+class TreeBuilder {
+public:
+	TreeBuilder(string_view source, ParseOptions const & options)
+		: source_(source), options_(options), index_(structural_index(source)) {}
+
+	std::unique_ptr<Expression> build();
+
+private:
+	string_view source_;
+	ParseOptions const & options_;
+	std::vector<std::uint32_t> index_;
+	std::size_t next_ = 0;
+	std::size_t nodes_ = 0;
+
+	struct Frame {
+		bool object;
+		// Where the keys and values of this list or object start in keys_
+		// and values_.
+		std::size_t first_key;
+		std::size_t first_value;
+	};
+
+	// The keys and values of all lists and objects that are not closed yet,
+	// so they are each allocated only once, at their final size.
+	std::vector<refcount_ptr<Expression const>> keys_;
+	std::vector<refcount_ptr<Expression const>> values_;
+
+	// The byte at the next entry of the index, or 0 at the end.
+	char peek() const {
+		return next_ < index_.size() ? source_[index_[next_]] : 0;
+	}
+
+	string_view here() const {
+		return next_ < index_.size() ? source_.substr(index_[next_], 1) : source_.substr(source_.size(), 0);
+	}
+
+	template<typename T> std::unique_ptr<T> node(std::unique_ptr<T>);
+	template<typename T, typename... Args> std::unique_ptr<T> make(Args &&...);
+
+	std::unique_ptr<Expression> close(std::vector<Frame> & stack);
+	void parse_key();
+	std::unique_ptr<StringLiteralExpression> parse_string();
+	std::unique_ptr<Expression> parse_value();
+	std::unique_ptr<Expression> parse_number(string_view);
+};
+
+template<typename T>
+std::unique_ptr<T> TreeBuilder::node(std::unique_ptr<T> node) {
+	if (++nodes_ > options_.limits.max_nodes) throw ParseLimitError(
+		"more than " + std::to_string(options_.limits.max_nodes) + " expressions",
+		source_.substr(0, 0)
+	);
+	return node;
+}
+
+template<typename T, typename... Args>
+std::unique_ptr<T> TreeBuilder::make(Args &&... args) {
+	return node(std::make_unique<T>(std::forward<Args>(args)...));
+}
+
+std::unique_ptr<Expression> TreeBuilder::build() {
+	// Nested lists and objects are kept on a stack of their own, so deeply
+	// nested input can't overflow the call stack.
+	std::vector<Frame> stack;
+	while (true) {
+		std::unique_ptr<Expression> value;
+		char c = peek();
+		if (c == '{' || c == '[') {
+			if (stack.size() >= options_.limits.max_depth) throw ParseLimitError(
+				"nesting deeper than " + std::to_string(options_.limits.max_depth) + " levels",
+				here()
+			);
+			stack.push_back({c == '{', keys_.size(), values_.size()});
+			++next_;
+			if (peek() != (c == '{' ? '}' : ']')) {
+				if (stack.back().object) parse_key();
+				continue;
+			}
+			++next_;
+			value = close(stack);
+		} else {
+			value = parse_value();
+		}
+
+		// Add the value to the innermost list or object, and close those
+		// that end after it.
+		while (true) {
+			if (stack.empty()) {
+				if (next_ != index_.size()) throw ParseError("expected end of file", here());
+				return value;
+			}
+			auto & frame = stack.back();
+			values_.push_back(std::move(value));
+			c = peek();
+			if (c == ',') {
+				++next_;
+				if (frame.object) parse_key();
+				break;
+			} else if (c == (frame.object ? '}' : ']')) {
+				++next_;
+				value = close(stack);
+			} else {
+				throw ParseError(frame.object ? "expected `,' or `}'" : "expected `,' or `]'", here());
+			}
+		}
+	}
+}
+
+std::unique_ptr<Expression> TreeBuilder::close(std::vector<Frame> & stack) {
+	auto frame = stack.back();
+	stack.pop_back();
+	auto take = [] (std::vector<refcount_ptr<Expression const>> & v, std::size_t first) {
+		std::vector<refcount_ptr<Expression const>> elements(
+			std::make_move_iterator(v.begin() + first),
+			std::make_move_iterator(v.end())
+		);
+		v.resize(first);
+		return elements;
+	};
+	auto values = make<ListExpression>(take(values_, frame.first_value));
+	if (!frame.object) return values;
+	return make<ObjectExpression>(make<ListExpression>(take(keys_, frame.first_key)), std::move(values));
+}
+
+void TreeBuilder::parse_key() {
+	if (peek() != '"') throw ParseError("expected string", here());
+	std::size_t open = index_[next_];
+	auto key = parse_string();
+	// Like in conftaal source, so the tree can be formatted and queried.
+	auto name = key->value();
+	if (!Parser::is_identifier(name)) throw ParseError(
+		"key is not an identifier",
+		source_.substr(open, key->source().size() + 2)
+	);
+	keys_.push_back(std::move(key));
+	if (peek() != ':') throw ParseError("expected `:'", here());
+	++next_;
+}
+
+std::unique_ptr<StringLiteralExpression> TreeBuilder::parse_string() {
+	std::size_t open = index_[next_];
+	// Nothing within a string is in the index, so the next entry is the
+	// closing quote.
+	if (next_ + 1 == index_.size()) throw ParseError("unterminated string literal", source_.substr(open));
+	std::size_t close = index_[next_ + 1];
+	next_ += 2;
+	auto contents = source_.substr(open + 1, close - open - 1);
+	if (std::memchr(contents.data(), '\\', contents.size())) {
+		return node(StringLiteralExpression::decoded(contents, decode_json_string(contents)));
+	}
+	return make<StringLiteralExpression>(contents);
+}
+
+std::unique_ptr<Expression> TreeBuilder::parse_value() {
+	char c = peek();
+	if (c == '"') return parse_string();
+	if (c == 0 || !is_value_byte(c)) throw ParseError("expected value", here());
+
+	// Numbers and words end at the first byte that can't be part of them.
+	std::size_t begin = index_[next_++];
+	std::size_t end = begin + 1;
+	while (end < source_.size() && is_value_byte(source_[end])) ++end;
+	auto value = source_.substr(begin, end - begin);
+
+	if (c == '-' || (c >= '0' && c <= '9')) return parse_number(value);
+	if (value == "true" || value == "false" || value == "null") return make<IdentifierExpression>(value);
+	throw ParseError("expected value", value);
+}
+
+std::unique_ptr<Expression> TreeBuilder::parse_number(string_view literal) {
+	auto const negative = literal[0] == '-';
+	auto const magnitude = literal.substr(negative);
+	auto is_digit = [&] (std::size_t i) { return i < magnitude.size() && magnitude[i] >= '0' && magnitude[i] <= '9'; };
+
+	std::size_t i = 0;
+	bool is_integer = true;
+	if (is_digit(0) && magnitude[0] == '0') {
+		++i;
+	} else {
+		while (is_digit(i)) ++i;
+	}
+	if (i == 0) throw ParseError("invalid number", literal);
+	if (i < magnitude.size() && magnitude[i] == '.') {
+		is_integer = false;
+		if (!is_digit(++i)) throw ParseError("invalid number", literal);
+		while (is_digit(i)) ++i;
+	}
+	if (i < magnitude.size() && (magnitude[i] == 'e' || magnitude[i] == 'E')) {
+		is_integer = false;
+		++i;
+		if (i < magnitude.size() && (magnitude[i] == '+' || magnitude[i] == '-')) ++i;
+		if (!is_digit(i)) throw ParseError("missing exponent", literal.substr(literal.size(), 0));
+		while (is_digit(i)) ++i;
+	}
+	if (i != magnitude.size()) throw ParseError("invalid number", literal);
+
+	std::unique_ptr<Expression> value;
+	auto const first = magnitude.data();
+	auto const last = first + magnitude.size();
+	if (is_integer) {
+		std::int64_t v;
+		if (std::from_chars(first, last, v).ec != std::errc()) throw ParseError(
+			"constant too large for 64-bit signed integer",
+			magnitude
+		);
+		value = make<IntegerLiteralExpression>(v);
+	} else {
+		double v;
+		if (std::from_chars(first, last, v).ec != std::errc()) {
+			// Out of range: round to infinity or zero, like the Parser does.
+			v = std::strtod(std::string(magnitude).c_str(), nullptr);
+		}
+		value = make<DoubleLiteralExpression>(v);
+	}
+	if (!negative) return value;
+	return make<OperatorExpression>(Operator::unary_minus, literal.substr(0, 1), nullptr, std::move(value));
+}
+
+}
+
+std::unique_ptr<Expression> parse_json(string_view source, ParseOptions options) {
+	// The structural index holds 32-bit offsets.
+	if (source.size() > std::numeric_limits<std::uint32_t>::max()) throw ParseError(
+		"source too large to be parsed as JSON",
+		source.substr(0, 0)
+	);
+	if (source.size() > options.limits.max_source_bytes) throw ParseLimitError(
+		"source larger than " + std::to_string(options.limits.max_source_bytes) + " bytes",
+		source.substr(options.limits.max_source_bytes, 0)
+	);
+	auto invalid = find_invalid_utf8(source);
+	if (invalid != string_view::npos) throw ParseError("invalid UTF-8", source.substr(invalid, 1));
+	return TreeBuilder(source, options).build();
+}
+
+}
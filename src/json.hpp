@@ -0,0 +1,26 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+#include "expression.hpp"
+#include "parse.hpp"
+
+namespace conftaal {
+
+// Parses JSON into the same expressions as the conftaal source for the
+// same data: objects, lists, strings and numbers, with negative numbers as
+// unary minus expressions. `true', `false' and `null' become identifiers.
+// As in conftaal source, the keys of objects must be identifiers.
+//
+// Like the Parser without a string_tracker, all locations in the tree and
+// in errors are views into the source. Only the source size, node and
+// depth limits are enforced.
+//
+// The source is first scanned 64 bytes at a time for the structural
+// characters, the quotes around strings, and the start of the other
+// values. The tree is then built from that index alone, without looking
+// at the bytes in between.
+std::unique_ptr<Expression> parse_json(std::string_view source, ParseOptions options = {});
+
+}
@@ -0,0 +1,221 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "error.hpp"
+#include "mapped_file.hpp"
+#include "module.hpp"
+#include "parse.hpp"
+
+namespace conftaal {
+
+namespace {
+
+char const usage[] =
+	"Usage: conftaal check [-j jobs] [--imports] [--format={text,json,sarif}] path...\n"
+	"\n"
+	"Parses all given files, and all files in the given directories, in\n"
+	"parallel, and reports all syntax errors in them. Exits with status 1\n"
+	"if any of them contains an error.\n";
+
+struct CheckOptions {
+	unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+	bool imports = false;
+	DiagnosticFormat format = DiagnosticFormat::text;
+	std::vector<std::string> paths;
+};
+
+// The files to check might not be trusted, so nesting deeper than any real
+// configuration is reported as an error, long before it would overflow the
+// stack.
+ParseOptions parse_options() {
+	ParseOptions options;
+	options.limits.max_depth = 1000;
+	return options;
+}
+
+// A file and the result of checking it. Only touched by one worker.
+struct CheckedFile {
+	std::string name;
+	std::optional<MappedFile> mapped;
+	std::string contents; // If the file could not be mapped.
+	std::string_view source;
+	std::vector<Error> errors;
+};
+
+// Expands directories into the files in them, skipping hidden ones, in a
+// stable order.
+std::vector<std::string> collect_files(std::vector<std::string> const & paths, std::vector<Error> & errors) {
+	namespace fs = std::filesystem;
+	std::vector<std::string> files;
+	for (auto const & path : paths) {
+		std::error_code ec;
+		if (!fs::is_directory(path, ec)) {
+			files.push_back(path);
+			continue;
+		}
+		std::vector<std::string> found;
+		auto options = fs::directory_options::skip_permission_denied;
+		for (auto i = fs::recursive_directory_iterator(path, options, ec); !ec && i != fs::recursive_directory_iterator(); i.increment(ec)) {
+			auto name = i->path().filename().string();
+			if (!name.empty() && name[0] == '.') {
+				if (i->is_directory(ec)) i.disable_recursion_pending();
+				continue;
+			}
+			if (i->is_regular_file(ec)) found.push_back(i->path().string());
+		}
+		if (ec) errors.emplace_back("unable to read directory `" + path + "': " + ec.message());
+		std::sort(found.begin(), found.end());
+		files.insert(files.end(), found.begin(), found.end());
+	}
+	return files;
+}
+
+void check_file(CheckedFile & file) {
+	file.mapped = MappedFile::open(file.name);
+	if (file.mapped) {
+		file.source = file.mapped->contents();
+	} else if (std::ifstream in{file.name, std::ios::binary}) {
+		file.contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		file.source = file.contents;
+	} else {
+		file.errors.emplace_back("unable to open `" + file.name + "'");
+		return;
+	}
+	try {
+		auto options = parse_options();
+		options.recover = true;
+		Parser parser(file.source, options);
+		auto expr = parser.parse_expression();
+		file.errors.assign(parser.errors().begin(), parser.errors().end());
+		if (!expr) throw ParseError("missing expression", file.source);
+	} catch (Error & e) {
+		file.errors.push_back(std::move(e));
+	}
+}
+
+int check(CheckOptions const & options) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<Error> errors;
+	auto names = collect_files(options.paths, errors);
+
+	// Sized once, so the sources never move while the workers run.
+	std::vector<CheckedFile> files(names.size());
+	for (std::size_t i = 0; i < names.size(); ++i) files[i].name = std::move(names[i]);
+
+	ModuleLoader modules(parse_options());
+	std::atomic<std::size_t> next{0};
+	auto work = [&] {
+		for (std::size_t i; (i = next++) < files.size();) {
+			if (options.imports) {
+				try {
+					modules.load(files[i].name);
+				} catch (Error & e) {
+					files[i].errors.push_back(std::move(e));
+				}
+			} else {
+				check_file(files[i]);
+			}
+		}
+	};
+	unsigned n_threads = std::min<std::size_t>(options.jobs, std::max<std::size_t>(files.size(), 1));
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < n_threads; ++i) threads.emplace_back(work);
+	work();
+	for (auto & t : threads) t.join();
+
+	DiagnosticSink sink;
+	std::size_t bytes = 0;
+	if (options.imports) modules.add_sources(sink);
+	for (auto const & file : files) {
+		if (!options.imports) sink.add_source(file.name, file.source);
+		bytes += file.source.size();
+	}
+	for (auto const & e : errors) sink.add(e);
+	std::size_t failed = 0;
+	for (auto const & file : files) {
+		for (auto const & e : file.errors) sink.add(e);
+		if (!file.errors.empty()) ++failed;
+	}
+
+	std::string out;
+	if (options.format == DiagnosticFormat::text) {
+		sink.render_text(out, isatty(2));
+		std::cerr << out << std::flush;
+	} else {
+		sink.render(out, options.format);
+		std::cout << out << std::flush;
+	}
+
+	std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+	char summary[200];
+	if (options.imports) {
+		std::snprintf(summary, sizeof(summary),
+			"checked %zu files (%zu parsed, including imports) in %.1f ms on %u thread(s): %zu failed\n",
+			files.size(), modules.parse_count(), time.count(), n_threads, failed + errors.size());
+	} else {
+		std::snprintf(summary, sizeof(summary),
+			"checked %zu files (%.1f MiB) in %.1f ms on %u thread(s): %zu failed\n",
+			files.size(), bytes / 1048576.0, time.count(), n_threads, failed + errors.size());
+	}
+	std::cerr << summary << std::flush;
+
+	return failed || !errors.empty() ? 1 : 0;
+}
+
+}
+
+}
+
+int main(int argc, char * * argv) {
+	if (argc < 2 || std::string_view(argv[1]) != "check") {
+		std::cerr << conftaal::usage;
+		return 2;
+	}
+
+	conftaal::CheckOptions options;
+	bool end_of_options = false;
+	for (int i = 2; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (end_of_options || arg.empty() || arg[0] != '-') {
+			options.paths.emplace_back(arg);
+		} else if (arg == "--") {
+			end_of_options = true;
+		} else if (arg == "-j" && i + 1 < argc) {
+			options.jobs = std::max(1, std::atoi(argv[++i]));
+		} else if (arg.substr(0, 2) == "-j" && arg.size() > 2) {
+			options.jobs = std::max(1, std::atoi(argv[i] + 2));
+		} else if (arg == "--imports") {
+			options.imports = true;
+		} else if (arg == "--format=text") {
+			options.format = conftaal::DiagnosticFormat::text;
+		} else if (arg == "--format=json") {
+			options.format = conftaal::DiagnosticFormat::json;
+		} else if (arg == "--format=sarif") {
+			options.format = conftaal::DiagnosticFormat::sarif;
+		} else {
+			std::cerr << conftaal::usage;
+			return 2;
+		}
+	}
+	if (options.paths.empty()) {
+		std::cerr << conftaal::usage;
+		return 2;
+	}
+
+	return conftaal::check(options);
+}
@@ -0,0 +1,59 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include <string_tracker.hpp>
+
+#include "mapped_file.hpp"
+
+namespace conftaal {
+
+MappedFile::MappedFile(MappedFile && other) noexcept
+	: data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile & MappedFile::operator = (MappedFile && other) noexcept {
+	std::swap(data_, other.data_);
+	std::swap(size_, other.size_);
+	return *this;
+}
+
+MappedFile::~MappedFile() {
+	if (data_) munmap(data_, size_);
+}
+
+std::optional<MappedFile> MappedFile::open(std::string const & file_name) {
+	int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return std::nullopt;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return std::nullopt;
+	}
+
+	void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return std::nullopt;
+
+	// The parser reads the source front to back, exactly once.
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	MappedFile file;
+	file.data_ = data;
+	file.size_ = st.st_size;
+	return file;
+}
+
+std::optional<std::string_view> SourceLoader::add_file(std::string file_name) {
+	auto file = MappedFile::open(file_name);
+	if (!file) return tracker_.add_file(std::move(file_name));
+	auto contents = file->contents();
+	files_.push_back(std::move(*file));
+	return tracker_.add_reference(contents, std::move(file_name));
+}
+
+}
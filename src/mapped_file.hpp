@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <string_tracker.hpp>
+
+namespace conftaal {
+
+using string_pool::string_tracker;
+
+// A read-only memory mapping of an entire file.
+class MappedFile {
+public:
+	MappedFile() {}
+	MappedFile(MappedFile && other) noexcept;
+	MappedFile & operator = (MappedFile && other) noexcept;
+	~MappedFile();
+
+	// Returns nothing if the file could not be opened, is not a regular
+	// file, or is empty (empty files cannot be mapped).
+	static std::optional<MappedFile> open(std::string const & file_name);
+
+	std::string_view contents() const {
+		return std::string_view(static_cast<char const *>(data_), size_);
+	}
+
+private:
+	void * data_ = nullptr;
+	std::size_t size_ = 0;
+};
+
+// Loads source files by mapping them into memory instead of reading them,
+// and registers them with its string_tracker.
+//
+// The mapped pages are never copied, so they are shared with every other
+// process that maps the same file. The loader must outlive all use of the
+// strings it returns. It owns the tracker, so the files stay mapped for as
+// long as the tracker exists.
+class SourceLoader {
+public:
+	SourceLoader() = default;
+
+	SourceLoader(SourceLoader const &) = delete;
+	SourceLoader & operator=(SourceLoader const &) = delete;
+
+	string_tracker & tracker() { return tracker_; }
+	string_tracker const & tracker() const { return tracker_; }
+
+	// Falls back to string_tracker::add_file for files that can not be
+	// mapped, such as pipes and empty files.
+	std::optional<std::string_view> add_file(std::string file_name);
+
+private:
+	// Destroyed after the tracker.
+	std::vector<MappedFile> files_;
+	string_tracker tracker_;
+};
+
+}
@@ -0,0 +1,213 @@
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+
+namespace conftaal {
+
+namespace {
+
+bool inside(string_view part, string_view whole) {
+	return part.data() >= whole.data() && part.data() + part.size() <= whole.data() + whole.size();
+}
+
+// Counts the expression itself, but not its children.
+MemoryUsage usage_of(Expression const & expr, string_view source) {
+	MemoryUsage usage;
+	usage.node_count = 1;
+	if (dynamic_cast<IdentifierExpression const *>(&expr)) {
+		usage.nodes = sizeof(IdentifierExpression);
+	} else if (dynamic_cast<OperatorExpression const *>(&expr)) {
+		usage.nodes = sizeof(OperatorExpression);
+	} else if (auto e = dynamic_cast<LambdaExpression const *>(&expr)) {
+		usage.nodes = sizeof(LambdaExpression);
+		usage.vectors = e->parameters.capacity() * sizeof(e->parameters[0]);
+	} else if (dynamic_cast<IntegerLiteralExpression const *>(&expr)) {
+		usage.nodes = sizeof(IntegerLiteralExpression);
+	} else if (dynamic_cast<DoubleLiteralExpression const *>(&expr)) {
+		usage.nodes = sizeof(DoubleLiteralExpression);
+	} else if (auto e = dynamic_cast<StringLiteralExpression const *>(&expr)) {
+		usage.nodes = sizeof(StringLiteralExpression) + e->escaped_state_bytes();
+		if (e->has_escapes()) {
+			usage.strings = e->decoded_bytes();
+		} else if (!inside(e->source(), source)) {
+			usage.strings = e->source().size();
+		}
+	} else if (dynamic_cast<ImportExpression const *>(&expr)) {
+		usage.nodes = sizeof(ImportExpression);
+	} else if (auto e = dynamic_cast<ListExpression const *>(&expr)) {
+		usage.nodes = sizeof(ListExpression);
+		usage.vectors = e->elements.capacity() * sizeof(e->elements[0]);
+	} else if (dynamic_cast<ObjectExpression const *>(&expr)) {
+		usage.nodes = sizeof(ObjectExpression);
+	} else if (dynamic_cast<ErrorExpression const *>(&expr)) {
+		usage.nodes = sizeof(ErrorExpression);
+	}
+	return usage;
+}
+
+template <typename F>
+void for_each_child(Expression const & expr, F && f) {
+	if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
+		if (e->lhs) f(*e->lhs);
+		f(*e->rhs);
+	} else if (auto e = dynamic_cast<ListExpression const *>(&expr)) {
+		for (auto const & element : e->elements) f(*element);
+	} else if (auto e = dynamic_cast<ObjectExpression const *>(&expr)) {
+		f(*e->keys);
+		f(*e->values);
+	} else if (auto e = dynamic_cast<LambdaExpression const *>(&expr)) {
+		f(*e->body);
+	} else if (auto e = dynamic_cast<ImportExpression const *>(&expr)) {
+		f(*e->path);
+	}
+}
+
+void escape_label(string_view value, std::string & out) {
+	for (char c : value) {
+		if (c == '\\' || c == '"') {
+			out += '\\';
+			out += c;
+		} else if (c == '\n') {
+			out += "\\n";
+		} else {
+			out += c;
+		}
+	}
+}
+
+void write_samples(
+	MemoryUsage const & usage, std::string & out, string_view labels,
+	string_view scope, string_view const * key
+) {
+	std::pair<char const *, std::size_t> kinds[] = {
+		{"nodes", usage.nodes},
+		{"vectors", usage.vectors},
+		{"strings", usage.strings},
+	};
+	for (auto const & kind : kinds) {
+		out += "conftaal_config_bytes{";
+		if (!labels.empty()) {
+			out += labels;
+			out += ',';
+		}
+		out += "scope=\"";
+		out += scope;
+		out += '"';
+		if (key) {
+			out += ",key=\"";
+			escape_label(*key, out);
+			out += '"';
+		}
+		out += ",kind=\"";
+		out += kind.first;
+		out += "\"} ";
+		out += std::to_string(kind.second);
+		out += '\n';
+	}
+}
+
+}
+
+MemoryUsage MemoryReport::total() const {
+	MemoryUsage usage = root;
+	for (auto const & key : keys) usage += key.second;
+	usage += shared;
+	return usage;
+}
+
+MemoryUsage memory_usage(Expression const & expr, string_view source) {
+	MemoryUsage usage;
+	std::unordered_set<Expression const *> seen;
+	std::vector<Expression const *> stack{&expr};
+	while (!stack.empty()) {
+		auto e = stack.back();
+		stack.pop_back();
+		if (!seen.insert(e).second) continue;
+		usage += usage_of(*e, source);
+		for_each_child(*e, [&] (Expression const & child) { stack.push_back(&child); });
+	}
+	return usage;
+}
+
+MemoryReport memory_report(ObjectExpression const & root, string_view source) {
+	auto const & keys = root.keys->elements;
+	auto const & values = root.values->elements;
+
+	// Who each expression belongs to: the index of a key, or one of these.
+	std::size_t const of_root = keys.size();
+	std::size_t const of_shared = keys.size() + 1;
+
+	std::unordered_map<Expression const *, std::size_t> owner;
+	owner[&root] = of_root;
+	owner[root.keys.get()] = of_root;
+	owner[root.values.get()] = of_root;
+
+	std::vector<std::pair<Expression const *, std::size_t>> stack;
+	auto walk = [&] {
+		while (!stack.empty()) {
+			auto [e, who] = stack.back();
+			stack.pop_back();
+			auto [i, inserted] = owner.emplace(e, who);
+			if (!inserted) {
+				if (i->second == who || i->second == of_shared) continue;
+				// Reachable through two different keys, and so is everything
+				// below it, even the parts we've seen before.
+				i->second = who = of_shared;
+			}
+			for_each_child(*e, [&, who = who] (Expression const & child) {
+				stack.emplace_back(&child, who);
+			});
+		}
+	};
+	for (std::size_t k = 0; k < keys.size(); ++k) {
+		stack.emplace_back(keys[k].get(), k);
+		stack.emplace_back(values[k].get(), k);
+		walk();
+	}
+
+	MemoryReport report;
+	for (auto const & key : keys) {
+		auto name = static_cast<StringLiteralExpression const &>(*key).value();
+		report.keys.emplace_back(std::string(name), MemoryUsage{});
+	}
+	for (auto const & [e, who] : owner) {
+		auto usage = usage_of(*e, source);
+		if (who == of_root) {
+			report.root += usage;
+		} else if (who == of_shared) {
+			report.shared += usage;
+		} else {
+			report.keys[who].second += usage;
+		}
+	}
+	return report;
+}
+
+void write_metrics_header(std::string & out) {
+	out += "# HELP conftaal_config_bytes Memory used by a parsed configuration.\n";
+	out += "# TYPE conftaal_config_bytes gauge\n";
+}
+
+void write_metrics(MemoryReport const & report, std::string & out, string_view labels) {
+	write_samples(report.root, out, labels, "root", nullptr);
+	write_samples(report.shared, out, labels, "shared", nullptr);
+	// Keep the order of the keys, but add up duplicates.
+	std::vector<std::pair<string_view, MemoryUsage>> keys;
+	std::unordered_map<string_view, std::size_t> index;
+	for (auto const & [name, usage] : report.keys) {
+		auto [i, inserted] = index.emplace(name, keys.size());
+		if (inserted) keys.emplace_back(name, MemoryUsage{});
+		keys[i->second].second += usage;
+	}
+	for (auto const & [name, usage] : keys) {
+		write_samples(usage, out, labels, "key", &name);
+	}
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+
+namespace conftaal {
+
+// Bytes used by (a part of) a tree of expressions, not counting allocator
+// overhead or the source it refers to.
+struct MemoryUsage {
+	std::size_t nodes = 0; // The expressions themselves.
+	std::size_t vectors = 0; // Storage of lists, and of lambda parameters.
+	std::size_t strings = 0; // String literal values that are not part of the source.
+	std::size_t node_count = 0;
+
+	std::size_t total() const { return nodes + vectors + strings; }
+
+	MemoryUsage & operator+=(MemoryUsage const & other) {
+		nodes += other.nodes;
+		vectors += other.vectors;
+		strings += other.strings;
+		node_count += other.node_count;
+		return *this;
+	}
+};
+
+// The memory used by a configuration, per key of its root object.
+//
+// Every expression is counted exactly once. Subtrees reachable through
+// more than one key, like values shared by an Overlay, are counted as
+// shared instead of under either key.
+struct MemoryReport {
+	// The root object, and its lists of keys and values.
+	MemoryUsage root;
+	// In the order of the keys, including duplicates. A key's own string
+	// literal is counted under it.
+	std::vector<std::pair<std::string, MemoryUsage>> keys;
+	MemoryUsage shared;
+
+	MemoryUsage total() const;
+};
+
+// String literal values outside of the source are counted as strings: the
+// values with escape sequences decoded by a string_tracker builder, or
+// decoded later by value(). Literals that are not decoded yet don't count.
+//
+// Imported modules are not included, as those are shared by everything
+// that imports them.
+//
+// Must not be used while another thread might be the first to call value()
+// on a string literal in the tree.
+MemoryUsage memory_usage(Expression const &, string_view source);
+MemoryReport memory_report(ObjectExpression const &, string_view source);
+
+// Appends the report as samples in the Prometheus text format, like
+// `conftaal_config_bytes{scope="key",key="limits",kind="nodes"} 1024'.
+// Duplicate keys are added together.
+//
+// The extra labels, like `tenant="a"', are added to every sample, so the
+// reports of many configurations can follow a single write_metrics_header().
+void write_metrics(MemoryReport const &, std::string & out, string_view labels = {});
+void write_metrics_header(std::string & out);
+
+}
@@ -0,0 +1,297 @@
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "error.hpp"
+#include "mapped_file.hpp"
+#include "module.hpp"
+
+namespace conftaal {
+
+struct ModuleLoader::Module {
+	// As given, or relative to the importing file. Used in diagnostics.
+	std::string name;
+	std::string path; // Canonical.
+
+	struct timespec mtime;
+	off_t size;
+
+	std::optional<MappedFile> file;
+	std::string contents; // If the file could not be mapped.
+	std::string_view source;
+
+	refcount_ptr<Expression const> root;
+	std::vector<std::shared_ptr<Module>> imports;
+
+	// Set once loading is done, after everything above. The error is set
+	// if it failed.
+	std::atomic<bool> done{false};
+	std::exception_ptr error;
+
+	// The modules this one is waiting for, to detect circular imports. More
+	// than one while its imports are loaded in parallel.
+	std::vector<Module const *> waiting_for;
+
+	// Whether this module is waiting for the other one, indirectly. Called
+	// with the mutex locked.
+	bool is_waiting_for(Module const * other) const {
+		std::vector<Module const *> todo{this};
+		std::unordered_set<Module const *> seen{this};
+		while (!todo.empty()) {
+			auto m = todo.back();
+			todo.pop_back();
+			if (m == other) return true;
+			for (auto w : m->waiting_for) {
+				if (seen.insert(w).second) todo.push_back(w);
+			}
+		}
+		return false;
+	}
+
+	void stop_waiting_for(Module const * other) {
+		waiting_for.erase(std::find(waiting_for.begin(), waiting_for.end(), other));
+	}
+};
+
+namespace {
+
+bool is_version(struct stat const & st, struct timespec mtime, off_t size) {
+	return st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec && st.st_size == size;
+}
+
+// The path of an import, relative to the directory of the importing file.
+std::string import_path(std::string const & importer, std::string_view name) {
+	if (!name.empty() && name[0] == '/') return std::string(name);
+	auto slash = importer.rfind('/');
+	if (slash == std::string::npos) return std::string(name);
+	return importer.substr(0, slash + 1) + std::string(name);
+}
+
+void collect_imports(Expression const & expr, std::vector<ImportExpression const *> & imports) {
+	if (auto e = dynamic_cast<ImportExpression const *>(&expr)) {
+		imports.push_back(e);
+	} else if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
+		if (e->lhs) collect_imports(*e->lhs, imports);
+		collect_imports(*e->rhs, imports);
+	} else if (auto e = dynamic_cast<ListExpression const *>(&expr)) {
+		for (auto const & v : e->elements) collect_imports(*v, imports);
+	} else if (auto e = dynamic_cast<ObjectExpression const *>(&expr)) {
+		collect_imports(*e->values, imports);
+	} else if (auto e = dynamic_cast<LambdaExpression const *>(&expr)) {
+		collect_imports(*e->body, imports);
+	}
+}
+
+}
+
+std::shared_ptr<Expression const> ModuleLoader::load(std::string const & file_name) {
+	Checked checked;
+	auto m = load(file_name, nullptr, nullptr, checked);
+	// Keeps the module, with the source it refers to, alive.
+	return std::shared_ptr<Expression const>(m, m->root.get());
+}
+
+void ModuleLoader::add_sources(DiagnosticSink & sink) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto const & m : modules_) {
+		if (m.second->source.data()) sink.add_source(m.second->name, m.second->source);
+	}
+	for (auto const & w : outdated_) {
+		auto m = w.lock();
+		if (m && m->source.data()) sink.add_source(m->name, m->source);
+	}
+}
+
+std::shared_ptr<ModuleLoader::Module> ModuleLoader::load(
+	std::string const & file_name, ImportExpression const * import, Module * importer, Checked & checked
+) {
+	bool created = false;
+	auto m = get(file_name, import ? import->source : std::string_view(), created, checked);
+
+	if (created) {
+		if (importer) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			importer->waiting_for.push_back(m.get());
+		}
+		std::exception_ptr error;
+		try {
+			parse(*m, checked);
+		} catch (...) {
+			error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (importer) importer->stop_waiting_for(m.get());
+			m->error = error;
+			m->done = true;
+		}
+		loaded_.notify_all();
+	} else if (!m->done) {
+		// Being loaded by another thread, or by this one if the import is
+		// circular.
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (importer) {
+			if (m->is_waiting_for(importer)) throw Error(
+				"circular import of `" + std::string(import->path->value()) + "'",
+				import->source
+			);
+			importer->waiting_for.push_back(m.get());
+		}
+		loaded_.wait(lock, [&] { return m->done.load(); });
+		if (importer) importer->stop_waiting_for(m.get());
+	}
+
+	if (m->error) std::rethrow_exception(m->error);
+	return m;
+}
+
+std::shared_ptr<ModuleLoader::Module> ModuleLoader::get(
+	std::string const & file_name, std::string_view where, bool & created, Checked & checked
+) {
+	auto unable_to_open = [&] {
+		return Error("unable to open `" + file_name + "'", where);
+	};
+
+	std::string path;
+	if (char * p = realpath(file_name.c_str(), nullptr)) {
+		path = p;
+		std::free(p);
+	} else {
+		throw unable_to_open();
+	}
+
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) throw unable_to_open();
+
+	std::shared_ptr<Module> cached;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto i = modules_.find(path);
+		if (i != modules_.end()) cached = i->second;
+	}
+	bool fresh = cached && is_version(st, cached->mtime, cached->size) && is_fresh(cached, checked);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto & slot = modules_[path];
+	// Another thread might have started loading a newer version meanwhile.
+	if (slot != cached) fresh = slot && is_version(st, slot->mtime, slot->size);
+	if (fresh) return slot;
+	if (slot) {
+		outdated_.erase(
+			std::remove_if(outdated_.begin(), outdated_.end(), [] (auto const & w) { return w.expired(); }),
+			outdated_.end()
+		);
+		outdated_.push_back(slot);
+	}
+
+	auto m = std::make_shared<Module>();
+	m->name = file_name;
+	m->path = std::move(path);
+	m->mtime = st.st_mtim;
+	m->size = st.st_size;
+	slot = m;
+	created = true;
+	return m;
+}
+
+bool ModuleLoader::is_fresh(std::shared_ptr<Module const> const & m, Checked & checked) const {
+	// Still loading, so just as new as its imports.
+	if (!m->done) return true;
+	// Failed, maybe because of an import that has been fixed since.
+	if (m->error) return false;
+	if (checked.count(m)) return true;
+	for (auto const & i : m->imports) {
+		struct stat st;
+		if (stat(i->path.c_str(), &st) != 0 || !is_version(st, i->mtime, i->size)) return false;
+		if (!is_fresh(i, checked)) return false;
+	}
+	checked.insert(m);
+	return true;
+}
+
+bool ModuleLoader::take_spare_thread() {
+	auto n = spare_threads_.load();
+	while (n > 0) {
+		if (spare_threads_.compare_exchange_weak(n, n - 1)) return true;
+	}
+	return false;
+}
+
+void ModuleLoader::parse(Module & m, Checked & checked) {
+	auto file = MappedFile::open(m.path);
+	std::string contents;
+	if (!file) {
+		std::ifstream in(m.path, std::ios::binary);
+		if (!in) throw Error("unable to open `" + m.name + "'");
+		contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	std::string_view source;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		m.file = std::move(file);
+		m.contents = std::move(contents);
+		source = m.source = m.file ? m.file->contents() : std::string_view(m.contents);
+	}
+
+	++parse_count_;
+	Parser parser(source, options_);
+	refcount_ptr<Expression const> root = parser.parse_expression();
+	if (!root) throw ParseError("missing expression", source);
+
+	std::vector<ImportExpression const *> imports;
+	collect_imports(*root, imports);
+
+	// All imports are loaded, also after one failed, and then the error of
+	// the first one that failed is thrown.
+	std::vector<std::shared_ptr<Module>> modules(imports.size());
+	std::vector<std::exception_ptr> errors(imports.size());
+	auto load_import = [&] (std::size_t k, Checked & checked) {
+		try {
+			modules[k] = load(import_path(m.name, imports[k]->path->value()), imports[k], &m, checked);
+		} catch (...) {
+			errors[k] = std::current_exception();
+		}
+	};
+	std::vector<std::thread> threads;
+	for (std::size_t k = 0; k < imports.size(); ++k) {
+		// The last one is loaded on this thread, which would wait otherwise.
+		if (k + 1 < imports.size() && take_spare_thread()) {
+			try {
+				threads.emplace_back([&, k] {
+					Checked checked;
+					load_import(k, checked);
+					++spare_threads_;
+				});
+				continue;
+			} catch (std::system_error &) {
+				++spare_threads_;
+			}
+		}
+		load_import(k, checked);
+	}
+	for (auto & t : threads) t.join();
+	for (auto const & e : errors) {
+		if (e) std::rethrow_exception(e);
+	}
+	for (std::size_t k = 0; k < imports.size(); ++k) imports[k]->module = modules[k]->root;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		m.root = std::move(root);
+		m.imports = std::move(modules);
+	}
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "diagnostics.hpp"
+#include "expression.hpp"
+#include "parse.hpp"
+
+namespace conftaal {
+
+// Loads files together with the files they import, parsing every file only
+// once.
+//
+// Files are cached by their path and modification time. Loading a file
+// again only parses the files that changed since, and the files that
+// (indirectly) import those. Every file is shared by all files importing
+// it, through ImportExpression::module.
+//
+// The imports of a file are loaded in parallel, on a thread per import for
+// as long as there are cores to spare, and otherwise on the thread that
+// needs them. Every file is parsed by only one thread, while others that
+// need it wait for it. Loading several files from multiple threads at once
+// also parses them in parallel.
+//
+// Files are parsed without a string_tracker (see Parser). Their contents
+// are kept in memory for as long as the expression returned by load() for
+// them or a file importing them exists, or until a newer version is loaded.
+class ModuleLoader {
+public:
+	explicit ModuleLoader(ParseOptions options = {})
+		: options_(options), spare_threads_(std::max(std::thread::hardware_concurrency(), 1u) - 1) {}
+
+	ModuleLoader(ModuleLoader const &) = delete;
+	ModuleLoader & operator=(ModuleLoader const &) = delete;
+
+	// Loads the file and all files it imports, recursively. Relative paths
+	// in imports are relative to the directory of the importing file.
+	//
+	// Throws the first Error encountered in any of the files.
+	// Safe to call from multiple threads at once.
+	std::shared_ptr<Expression const> load(std::string const & file_name);
+
+	// The number of times a file was parsed.
+	std::size_t parse_count() const { return parse_count_; }
+
+	// Adds all loaded files, to render the errors thrown by load().
+	void add_sources(DiagnosticSink &) const;
+
+private:
+	struct Module;
+
+	// The modules found to be up to date during a call to load(), so they
+	// are checked only once.
+	using Checked = std::unordered_set<std::shared_ptr<Module const>>;
+
+	// Returns the loaded module, after parsing it on this thread if needed.
+	// For an import, the importer is the module being parsed.
+	std::shared_ptr<Module> load(std::string const & file_name, ImportExpression const *, Module * importer, Checked &);
+	// Returns the module, or a new one that still needs to be parsed by the
+	// caller if created is set.
+	std::shared_ptr<Module> get(std::string const & file_name, std::string_view where, bool & created, Checked &);
+	// Called without the mutex locked, as it checks the files on disk.
+	bool is_fresh(std::shared_ptr<Module const> const &, Checked &) const;
+	void parse(Module &, Checked &);
+	bool take_spare_thread();
+
+	ParseOptions options_;
+
+	mutable std::mutex mutex_;
+
+	// Notified whenever a module is done loading.
+	std::condition_variable loaded_;
+
+	// By canonical path.
+	std::map<std::string, std::shared_ptr<Module>> modules_;
+
+	// Older versions of files, which might still be in use, through the
+	// expression returned by load() or an importer that is outdated too.
+	// Those no longer in use are removed whenever another one is added.
+	std::vector<std::weak_ptr<Module>> outdated_;
+
+	std::atomic<std::size_t> parse_count_{0};
+
+	// The threads that may be started to load imports in parallel.
+	std::atomic<unsigned> spare_threads_;
+};
+
+}
@@ -0,0 +1,241 @@
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "error.hpp"
+#include "expression.hpp"
+#include "numeric.hpp"
+
+namespace conftaal {
+
+bool is_arithmetic(Operator op) {
+	switch (op) {
+		case Operator::plus:
+		case Operator::minus:
+		case Operator::times:
+		case Operator::divide:
+		case Operator::modulo:
+		case Operator::power:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool is_integer_only(Operator op) {
+	switch (op) {
+		case Operator::left_shift:
+		case Operator::right_shift:
+		case Operator::bit_and:
+		case Operator::bit_or:
+		case Operator::bit_xor:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool is_comparison(Operator op) {
+	switch (op) {
+		case Operator::equal:
+		case Operator::inequal:
+		case Operator::greater:
+		case Operator::less:
+		case Operator::greater_or_equal:
+		case Operator::less_or_equal:
+			return true;
+		default:
+			return false;
+	}
+}
+
+namespace {
+
+// The source of an expression that is not numeric, if it has one.
+string_view source_of(Expression const & expr) {
+	if (auto e = dynamic_cast<StringLiteralExpression const *>(&expr)) return e->source();
+	if (auto e = dynamic_cast<ImportExpression const *>(&expr)) return e->source;
+	if (auto e = dynamic_cast<ErrorExpression const *>(&expr)) return e->source;
+	return {};
+}
+
+// 'parent' is the source of the operator the expression is an operand of,
+// to point at for expressions without a source of their own.
+std::size_t compile(
+	Expression const & expr, std::vector<NumericType> const & input_types,
+	NumericInputLookup const & input_of, std::vector<NumericNode> & nodes,
+	string_view parent = {}
+) {
+	NumericNode node{};
+	if (auto i = input_of(expr); i != no_input) {
+		node.kind = NumericNode::Kind::input;
+		node.type = input_types[i];
+		node.rhs = i;
+	} else if (auto e = dynamic_cast<IntegerLiteralExpression const *>(&expr)) {
+		node.kind = NumericNode::Kind::constant;
+		node.type = NumericType::integer;
+		node.integer = e->value;
+	} else if (auto e = dynamic_cast<DoubleLiteralExpression const *>(&expr)) {
+		node.kind = NumericNode::Kind::constant;
+		node.type = NumericType::floating;
+		node.floating = e->value;
+	} else if (auto e = dynamic_cast<IdentifierExpression const *>(&expr)) {
+		throw Error("unknown input `" + std::string(e->identifier) + "'", e->identifier);
+	} else if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
+		node.op = e->op;
+		auto unsupported = [&] (std::string const & why) {
+			return Error("`" + std::string(e->op_source) + "' " + why, e->op_source);
+		};
+		if (e->is_unary()) {
+			node.kind = NumericNode::Kind::unary;
+			node.rhs = compile(*e->rhs, input_types, input_of, nodes, e->op_source);
+			auto rhs_type = nodes[node.rhs].type;
+			if (e->op == Operator::complement && rhs_type != NumericType::integer) {
+				throw unsupported("needs an integer operand");
+			}
+			node.type = e->op == Operator::logical_not ? NumericType::integer : rhs_type;
+		} else {
+			if (
+				!is_arithmetic(e->op) && !is_integer_only(e->op) && !is_comparison(e->op) &&
+				e->op != Operator::logical_and && e->op != Operator::logical_or
+			) {
+				throw unsupported("is not supported in numeric evaluation");
+			}
+			node.kind = NumericNode::Kind::binary;
+			node.lhs = compile(*e->lhs, input_types, input_of, nodes, e->op_source);
+			node.rhs = compile(*e->rhs, input_types, input_of, nodes, e->op_source);
+			bool integers =
+				nodes[node.lhs].type == NumericType::integer &&
+				nodes[node.rhs].type == NumericType::integer;
+			if (is_integer_only(e->op) && !integers) throw unsupported("needs integer operands");
+			node.type = integers || !is_arithmetic(e->op) ? NumericType::integer : NumericType::floating;
+		}
+	} else {
+		auto where = source_of(expr);
+		throw Error(
+			"only numbers, identifiers and operators are supported in numeric evaluation",
+			where.data() ? where : parent
+		);
+	}
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+}
+
+std::vector<NumericNode> compile_numeric(Expression const & expr, NumericInputs const & inputs) {
+	std::vector<NumericType> types;
+	for (auto const & input : inputs) types.push_back(input.second);
+	return compile_numeric(expr, types, [&] (Expression const & e) {
+		if (auto id = dynamic_cast<IdentifierExpression const *>(&e)) {
+			for (std::size_t i = 0; i < inputs.size(); ++i) {
+				if (inputs[i].first == id->identifier) return i;
+			}
+		}
+		return no_input;
+	});
+}
+
+std::vector<NumericNode> compile_numeric(
+	Expression const & expr, std::vector<NumericType> const & input_types, NumericInputLookup const & input_of
+) {
+	std::vector<NumericNode> nodes;
+	compile(expr, input_types, input_of, nodes);
+	return nodes;
+}
+
+std::int64_t apply_binary(NumericNode const & node, NumericType operand_type, std::int64_t a, std::int64_t b, std::uint8_t & failed) {
+	if (operand_type == NumericType::integer) {
+		switch (node.op) {
+			case Operator::plus:             return wrapping_add(a, b);
+			case Operator::minus:            return wrapping_sub(a, b);
+			case Operator::times:            return wrapping_mul(a, b);
+			case Operator::divide:           return integer_divide(a, b, failed);
+			case Operator::modulo:           return integer_modulo(a, b, failed);
+			case Operator::power:            return integer_power(a, b, failed);
+			case Operator::left_shift:
+			case Operator::right_shift:      return shift(node.op, a, b, failed);
+			case Operator::bit_and:          return a & b;
+			case Operator::bit_or:           return a | b;
+			case Operator::bit_xor:          return a ^ b;
+			case Operator::equal:            return a == b;
+			case Operator::inequal:          return a != b;
+			case Operator::greater:          return a > b;
+			case Operator::less:             return a < b;
+			case Operator::greater_or_equal: return a >= b;
+			case Operator::less_or_equal:    return a <= b;
+			default:                         return 0;
+		}
+	}
+	double x = from_bits(a);
+	double y = from_bits(b);
+	switch (node.op) {
+		case Operator::plus:             return to_bits(x + y);
+		case Operator::minus:            return to_bits(x - y);
+		case Operator::times:            return to_bits(x * y);
+		case Operator::divide:           return to_bits(x / y);
+		case Operator::modulo:           return to_bits(std::fmod(x, y));
+		case Operator::power:            return to_bits(std::pow(x, y));
+		case Operator::equal:            return x == y;
+		case Operator::inequal:          return x != y;
+		case Operator::greater:          return x > y;
+		case Operator::less:             return x < y;
+		case Operator::greater_or_equal: return x >= y;
+		case Operator::less_or_equal:    return x <= y;
+		default:                         return 0;
+	}
+}
+
+namespace {
+
+// Evaluates the node, converted to the given type.
+std::int64_t interpret_as(
+	std::vector<NumericNode> const & nodes, std::size_t index, NumericType type,
+	std::int64_t const * inputs, std::uint8_t & failed
+) {
+	auto v = interpret(nodes, index, inputs, failed);
+	if (type == NumericType::floating && nodes[index].type == NumericType::integer) v = to_bits(double(v));
+	return v;
+}
+
+bool truthy(NumericType type, std::int64_t v) {
+	return type == NumericType::integer ? v != 0 : from_bits(v) != 0;
+}
+
+}
+
+std::int64_t interpret(std::vector<NumericNode> const & nodes, std::size_t index, std::int64_t const * inputs, std::uint8_t & failed) {
+	auto const & node = nodes[index];
+	switch (node.kind) {
+		case NumericNode::Kind::input:
+			return inputs[node.rhs];
+		case NumericNode::Kind::constant:
+			return node.type == NumericType::integer ? node.integer : to_bits(node.floating);
+		case NumericNode::Kind::unary: {
+			auto type = nodes[node.rhs].type;
+			auto v = interpret(nodes, node.rhs, inputs, failed);
+			switch (node.op) {
+				case Operator::logical_not: return !truthy(type, v);
+				case Operator::complement:  return ~v;
+				case Operator::unary_minus: return type == NumericType::integer ? wrapping_sub(0, v) : to_bits(-from_bits(v));
+				default:                    return v;
+			}
+		}
+		case NumericNode::Kind::binary:
+			break;
+	}
+	if (node.op == Operator::logical_and || node.op == Operator::logical_or) {
+		bool is_and = node.op == Operator::logical_and;
+		if (truthy(nodes[node.lhs].type, interpret(nodes, node.lhs, inputs, failed)) != is_and) return !is_and;
+		return truthy(nodes[node.rhs].type, interpret(nodes, node.rhs, inputs, failed));
+	}
+	auto type =
+		nodes[node.lhs].type == NumericType::integer && nodes[node.rhs].type == NumericType::integer
+		? NumericType::integer : NumericType::floating;
+	auto a = interpret_as(nodes, node.lhs, type, inputs, failed);
+	auto b = interpret_as(nodes, node.rhs, type, inputs, failed);
+	return apply_binary(node, type, a, b, failed);
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+#include "operator.hpp"
+
+// Numeric expressions, as evaluated by BatchEvaluator and CompiledExpression.
+//
+// Integers are 64-bit and wrap around on overflow. An operation on an
+// integer and a floating point number converts the integer first.
+// Comparisons and logical operators result in the integers 0 or 1.
+// Integer division truncates. `&&' and `||' only evaluate their right hand
+// side when needed.
+//
+// Evaluation fails on integer division by zero, shifting by a negative
+// amount or by 64 or more, and a negative integer power of an integer.
+
+namespace conftaal {
+
+enum class NumericType {
+	integer,
+	floating,
+};
+
+using NumericInputs = std::vector<std::pair<std::string_view, NumericType>>;
+
+struct NumericNode {
+	enum class Kind { input, constant, unary, binary } kind;
+	NumericType type;
+	Operator op = Operator::plus;
+	std::size_t lhs = 0; // Index of the node.
+	std::size_t rhs = 0; // Index of the node, or of the input.
+	std::int64_t integer = 0;
+	double floating = 0;
+};
+
+// Compiles the expression to nodes in post-order: the children of a node
+// come before it, and the last node is the root.
+//
+// Every identifier in the expression must be one of the named inputs.
+// Throws an Error pointing at the first unsupported subexpression.
+std::vector<NumericNode> compile_numeric(Expression const &, NumericInputs const &);
+
+constexpr std::size_t no_input = -1;
+
+// Returns the index of the input a subexpression refers to, or no_input.
+using NumericInputLookup = std::function<std::size_t(Expression const &)>;
+
+// Like the above, but with the inputs found by a function instead of by
+// name, so that also, for example, `a.b' can be an input.
+std::vector<NumericNode> compile_numeric(Expression const &, std::vector<NumericType> const & input_types, NumericInputLookup const &);
+
+bool is_arithmetic(Operator);
+bool is_integer_only(Operator);
+bool is_comparison(Operator);
+
+inline std::int64_t to_bits(double v) {
+	std::int64_t bits;
+	std::memcpy(&bits, &v, sizeof(bits));
+	return bits;
+}
+
+inline double from_bits(std::int64_t bits) {
+	double v;
+	std::memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+inline std::int64_t wrapping_add(std::int64_t a, std::int64_t b) { return std::uint64_t(a) + std::uint64_t(b); }
+inline std::int64_t wrapping_sub(std::int64_t a, std::int64_t b) { return std::uint64_t(a) - std::uint64_t(b); }
+inline std::int64_t wrapping_mul(std::int64_t a, std::int64_t b) { return std::uint64_t(a) * std::uint64_t(b); }
+
+// Sets 'failed' on division by zero.
+inline std::int64_t integer_divide(std::int64_t a, std::int64_t b, std::uint8_t & failed) {
+	if (b == 0) {
+		failed = 1;
+		return 0;
+	}
+	// Avoid overflow on the smallest integer.
+	if (b == -1) return wrapping_sub(0, a);
+	return a / b;
+}
+
+inline std::int64_t integer_modulo(std::int64_t a, std::int64_t b, std::uint8_t & failed) {
+	if (b == 0) {
+		failed = 1;
+		return 0;
+	}
+	if (b == -1) return 0;
+	return a % b;
+}
+
+// Sets 'failed' on a negative exponent.
+inline std::int64_t integer_power(std::int64_t base, std::int64_t exponent, std::uint8_t & failed) {
+	if (exponent < 0) {
+		failed = 1;
+		return 0;
+	}
+	std::uint64_t result = 1;
+	std::uint64_t b = base;
+	for (std::uint64_t e = exponent; e; e >>= 1) {
+		if (e & 1) result *= b;
+		b *= b;
+	}
+	return result;
+}
+
+// Sets 'failed' when not shifting by 0 to 63 bits.
+inline std::int64_t shift(Operator op, std::int64_t a, std::int64_t b, std::uint8_t & failed) {
+	if (b < 0 || b > 63) {
+		failed = 1;
+		return 0;
+	}
+	return op == Operator::left_shift ? std::int64_t(std::uint64_t(a) << b) : a >> b;
+}
+
+// Applies a binary operator, other than `&&' and `||', to two operands of
+// the type of its node (or to operands of its operands' type, for
+// comparisons). Floating point numbers are passed as their bits.
+std::int64_t apply_binary(NumericNode const & node, NumericType operand_type, std::int64_t a, std::int64_t b, std::uint8_t & failed);
+
+// Evaluates the node by walking the tree, with the inputs as integers or
+// as the bits of floating point numbers.
+std::int64_t interpret(std::vector<NumericNode> const &, std::size_t node, std::int64_t const * inputs, std::uint8_t & failed);
+
+}
@@ -0,0 +1,188 @@
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "expression.hpp"
+#include "overlay.hpp"
+
+namespace conftaal {
+
+// A node of a treap: a binary search tree on the names, which is also a
+// heap on the priorities. The priorities are hashes of the names, so the
+// shape of the tree only depends on the keys, and is balanced with high
+// probability.
+struct Overlay::Node final : refcounted {
+	refcount_ptr<Expression const> key;
+	string_view name;
+	std::uint64_t priority = 0;
+
+	bool is_object = false;
+	refcount_ptr<Expression const> value; // If !is_object.
+	Overlay object; // If is_object.
+
+	refcount_ptr<Node const> left;
+	refcount_ptr<Node const> right;
+	std::size_t size = 1;
+};
+
+Overlay::Overlay() = default;
+Overlay::Overlay(Overlay const &) = default;
+Overlay::Overlay(Overlay &&) noexcept = default;
+Overlay & Overlay::operator=(Overlay const &) = default;
+Overlay & Overlay::operator=(Overlay &&) noexcept = default;
+Overlay::~Overlay() = default;
+
+Overlay::Overlay(refcount_ptr<Node const> root) : root_(std::move(root)) {}
+
+namespace {
+
+std::uint64_t hash(string_view name) {
+	std::uint64_t h = 0xcbf29ce484222325;
+	for (unsigned char c : name) {
+		h ^= c;
+		h *= 0x100000001b3;
+	}
+	// FNV alone mixes the last characters poorly into the high bits, which
+	// decide the shape of the tree. Finish with the MurmurHash3 mixer.
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccd;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53;
+	h ^= h >> 33;
+	return h;
+}
+
+// Looks through imports.
+ObjectExpression const * as_object(Expression const & e) {
+	if (auto i = dynamic_cast<ImportExpression const *>(&e)) {
+		return i->module ? as_object(*i->module) : nullptr;
+	}
+	return dynamic_cast<ObjectExpression const *>(&e);
+}
+
+}
+
+Overlay::Overlay(ObjectExpression const & object) : Overlay(Overlay().layer(object)) {}
+
+std::size_t Overlay::size() const {
+	return root_ ? root_->size : 0;
+}
+
+Overlay::Node const * Overlay::find(string_view name) const {
+	Node const * n = root_.get();
+	while (n && n->name != name) n = name < n->name ? n->left.get() : n->right.get();
+	return n;
+}
+
+bool Overlay::contains(string_view name) const {
+	return find(name) != nullptr;
+}
+
+Expression const * Overlay::value(string_view name) const {
+	auto n = find(name);
+	return n && !n->is_object ? n->value.get() : nullptr;
+}
+
+Overlay const * Overlay::object(string_view name) const {
+	auto n = find(name);
+	return n && n->is_object ? &n->object : nullptr;
+}
+
+std::vector<string_view> Overlay::keys() const {
+	std::vector<string_view> keys;
+	keys.reserve(size());
+	std::vector<Node const *> stack;
+	for (Node const * n = root_.get(); n || !stack.empty();) {
+		if (n) {
+			stack.push_back(n);
+			n = n->left.get();
+		} else {
+			n = stack.back();
+			stack.pop_back();
+			keys.push_back(n->name);
+			n = n->right.get();
+		}
+	}
+	return keys;
+}
+
+Overlay Overlay::layer(ObjectExpression const & object) const {
+	using NodePtr = refcount_ptr<Node const>;
+
+	auto size = [] (NodePtr const & n) { return n ? n->size : 0; };
+
+	auto with_children = [&] (Node const & n, NodePtr left, NodePtr right) {
+		auto copy = std::make_unique<Node>(n);
+		copy->left = std::move(left);
+		copy->right = std::move(right);
+		copy->size = 1 + size(copy->left) + size(copy->right);
+		return NodePtr(std::move(copy));
+	};
+
+	auto above = [] (Node const & a, Node const & b) {
+		return a.priority != b.priority ? a.priority > b.priority : a.name < b.name;
+	};
+
+	// Path copying insertion. Only the new node can be out of heap order,
+	// and only at the top of the returned subtree, so a single rotation per
+	// level restores it.
+	auto insert = [&] (auto & self, NodePtr const & t, Node const & entry) -> NodePtr {
+		if (!t) return NodePtr(std::make_unique<Node>(entry));
+		if (entry.name == t->name) return with_children(entry, t->left, t->right);
+		if (entry.name < t->name) {
+			auto l = self(self, t->left, entry);
+			if (above(*l, *t)) return with_children(*l, l->left, with_children(*t, l->right, t->right));
+			return with_children(*t, std::move(l), t->right);
+		} else {
+			auto r = self(self, t->right, entry);
+			if (above(*r, *t)) return with_children(*r, with_children(*t, t->left, r->left), r->right);
+			return with_children(*t, t->left, std::move(r));
+		}
+	};
+
+	auto const & keys = object.keys->elements;
+	auto const & values = object.values->elements;
+
+	// The last of duplicate keys wins.
+	std::unordered_set<string_view> seen;
+	NodePtr root = root_;
+	for (std::size_t i = keys.size(); i-- > 0;) {
+		Node entry;
+		entry.key = keys[i];
+		entry.name = static_cast<StringLiteralExpression const &>(*keys[i]).value();
+		if (!seen.insert(entry.name).second) continue;
+		entry.priority = hash(entry.name);
+		if (auto nested = as_object(*values[i])) {
+			entry.is_object = true;
+			auto below = find(entry.name);
+			entry.object = below && below->is_object ? below->object.layer(*nested) : Overlay(*nested);
+		} else {
+			entry.value = values[i];
+		}
+		root = insert(insert, root, entry);
+	}
+	return Overlay(std::move(root));
+}
+
+refcount_ptr<ObjectExpression const> Overlay::to_expression() const {
+	std::vector<refcount_ptr<Expression const>> keys;
+	std::vector<refcount_ptr<Expression const>> values;
+	keys.reserve(size());
+	values.reserve(size());
+	auto visit = [&] (auto & self, Node const * n) -> void {
+		if (!n) return;
+		self(self, n->left.get());
+		keys.push_back(n->key);
+		values.push_back(n->is_object ? n->object.to_expression() : n->value);
+		self(self, n->right.get());
+	};
+	visit(visit, root_.get());
+	return std::make_unique<ObjectExpression>(
+		std::make_unique<ListExpression>(std::move(keys)),
+		std::make_unique<ListExpression>(std::move(values))
+	);
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "expression.hpp"
+
+namespace conftaal {
+
+// An immutable view of objects layered on top of each other, like a base
+// configuration with overrides for a region, a cluster and a host.
+//
+// Keys of a layer replace those of the layers below it, except when both
+// values are objects, in which case those are layered as well.
+//
+// Views are persistent maps: adding a layer copies only the O(log n) path
+// to each key it changes, and shares everything else with the view below.
+// Building a view of a large base configuration once, and then a view per
+// host on top of that, costs only O(k log n) per host for k overridden
+// keys. The expressions themselves are never copied.
+class Overlay {
+public:
+	// An empty view.
+	Overlay();
+
+	Overlay(Overlay const &);
+	Overlay(Overlay &&) noexcept;
+	Overlay & operator=(Overlay const &);
+	Overlay & operator=(Overlay &&) noexcept;
+	~Overlay();
+
+	// A view of a single object, including the objects nested in it.
+	explicit Overlay(ObjectExpression const & object);
+
+	// A view of this one with the object layered on top.
+	Overlay layer(ObjectExpression const & object) const;
+
+	bool empty() const { return root_ == nullptr; }
+	std::size_t size() const;
+
+	bool contains(string_view name) const;
+
+	// The value of the key, or null if it is missing or an object.
+	Expression const * value(string_view name) const;
+
+	// The view of the object under this key, or null if it is missing or
+	// not an object. Valid for as long as this view exists.
+	Overlay const * object(string_view name) const;
+
+	// All keys, in order of their names.
+	std::vector<string_view> keys() const;
+
+	// Builds an ObjectExpression with the contents of this view, with the
+	// keys in order of their names. Takes O(n) time.
+	refcount_ptr<ObjectExpression const> to_expression() const;
+
+private:
+	struct Node;
+
+	explicit Overlay(refcount_ptr<Node const> root);
+
+	Node const * find(string_view name) const;
+
+	refcount_ptr<Node const> root_;
+};
+
+}
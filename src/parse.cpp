@@ -3,14 +3,18 @@
 #include <cstdlib>
 #include <limits>
 #include <optional>
+#include <string>
 #include <stdexcept>
 #include <string_view>
+#include <unordered_set>
 
 #include <string_tracker.hpp>
 
+#include "escape.hpp"
 #include "expression.hpp"
 #include "operator.hpp"
 #include "parse.hpp"
+#include "utf8.hpp"
 
 namespace conftaal {
 
@@ -30,6 +34,41 @@ void skip_whitespace(string_view & source, bool skip_newlines) {
 	}
 }
 
+// Finds where the element of an object or list that starts at the start of
+// the source ends: at the first `,', `;' or newline outside of brackets, or
+// at a closing bracket that wasn't opened in it. Only at the latter if not
+// 'separators'.
+std::size_t find_element_end(string_view source, bool separators = true) {
+	std::string closing;
+	for (std::size_t i = 0; i < source.size(); ++i) {
+		switch (source[i]) {
+			case '"':
+				for (++i; i < source.size() && source[i] != '"'; ++i) {
+					if (source[i] == '\\') ++i;
+				}
+				break;
+			case '#':
+				while (i + 1 < source.size() && source[i + 1] != '\n') ++i;
+				break;
+			case '(': closing += ')'; break;
+			case '[': closing += ']'; break;
+			case '{': closing += '}'; break;
+			case ')': case ']': case '}': {
+				// Brackets opened in the element but never closed are
+				// closed by this one as well.
+				auto open = closing.rfind(source[i]);
+				if (open == std::string::npos) return i;
+				closing.resize(open);
+				break;
+			}
+			case ',': case ';': case '\n':
+				if (separators && closing.empty()) return i;
+				break;
+		}
+	}
+	return source.size();
+}
+
 }
 
 enum class MatchMode {
@@ -94,6 +133,11 @@ public:
 		return *m;
 	}
 
+	// The closing bracket, if this matches one.
+	char closing_bracket() const {
+		return mode_ == MatchMode::matching_bracket ? expected_[0] : 0;
+	}
+
 	// Life time of the 'or before' matcher must be at least as long as
 	// the life time of this matcher.
 	Matcher or_before(Matcher const & alt) {
@@ -103,6 +147,10 @@ public:
 	// Prevent taking temporaries.
 	Matcher or_before(Matcher const &&) = delete;
 
+	bool is_end_of_file() const {
+		return mode_ == MatchMode::end_of_file && !or_before_;
+	}
+
 	std::string description() const {
 		std::string desc;
 		switch (mode_) {
@@ -139,6 +187,132 @@ public:
 
 Matcher match_end_of_file = conftaal::MatchMode::end_of_file;
 
+Parser::Parser(string_tracker & tracker, string_view source, ParseOptions options)
+	: string_tracker_(&tracker), source_(source), options_(options)
+{
+	check_limits();
+	check_encoding();
+}
+
+Parser::Parser(string_view source, ParseOptions options)
+	: string_tracker_(nullptr), source_(source), options_(options)
+{
+	check_limits();
+	check_encoding();
+}
+
+void Parser::check_encoding() {
+	// With the source valid UTF-8, only escape sequences can make a string
+	// literal invalid, and those are checked while parsing the literal.
+	auto invalid = find_invalid_utf8(source_);
+	if (invalid != string_view::npos) throw ParseError("invalid UTF-8", source_.substr(invalid, 1));
+}
+
+void Parser::check_limits() {
+	auto const & limits = options_.limits;
+	if (source_.size() > limits.max_source_bytes) throw ParseLimitError(
+		"source larger than " + std::to_string(limits.max_source_bytes) + " bytes",
+		source_.substr(limits.max_source_bytes, 0)
+	);
+	auto now = std::chrono::steady_clock::now();
+	if (limits.max_time < std::chrono::steady_clock::time_point::max() - now) {
+		deadline_ = now + limits.max_time;
+	} else {
+		deadline_ = std::chrono::steady_clock::time_point::max();
+	}
+}
+
+void Parser::allocated(std::size_t bytes) {
+	allocated_bytes_ += bytes;
+	if (allocated_bytes_ > options_.limits.max_allocated_bytes) throw ParseLimitError(
+		"parsing needs more than " + std::to_string(options_.limits.max_allocated_bytes) + " bytes of memory",
+		source_.substr(0, 0)
+	);
+}
+
+template<typename T>
+std::unique_ptr<T> Parser::node(std::unique_ptr<T> node) {
+	if (!node) return node;
+	if (++nodes_ > options_.limits.max_nodes) throw ParseLimitError(
+		"more than " + std::to_string(options_.limits.max_nodes) + " expressions",
+		source_.substr(0, 0)
+	);
+	allocated(sizeof(T));
+	// Reading the clock is cheap, but not free.
+	if (nodes_ % 64 == 0 && std::chrono::steady_clock::now() > deadline_) throw ParseLimitError(
+		"parsing took too long",
+		source_.substr(0, 0)
+	);
+	return node;
+}
+
+template<typename T, typename... Args>
+std::unique_ptr<T> Parser::make(Args &&... args) {
+	return node(std::make_unique<T>(std::forward<Args>(args)...));
+}
+
+template<typename T, typename U>
+void Parser::push_back(std::vector<T> & vector, U && value) {
+	auto capacity = vector.capacity();
+	vector.push_back(std::forward<U>(value));
+	if (vector.capacity() != capacity) allocated((vector.capacity() - capacity) * sizeof(T));
+}
+
+class DepthGuard {
+public:
+	explicit DepthGuard(Parser & parser) : parser_(parser) {
+		if (++parser_.depth_ > parser_.options_.limits.max_depth) throw ParseLimitError(
+			"nesting deeper than " + std::to_string(parser_.options_.limits.max_depth) + " levels",
+			parser_.source_.substr(0, 0)
+		);
+		if (parser_.depth_ > parser_.max_depth_) parser_.max_depth_ = parser_.depth_;
+		if (parser_.depth_ > parser_.deepest_) parser_.deepest_ = parser_.depth_;
+	}
+	~DepthGuard() { --parser_.depth_; }
+	DepthGuard(DepthGuard const &) = delete;
+	DepthGuard & operator = (DepthGuard const &) = delete;
+private:
+	Parser & parser_;
+};
+
+// Keeps the closing bracket of a list or object in Parser::closing_ while
+// parsing it.
+class ClosingGuard {
+public:
+	ClosingGuard(Parser & parser, Matcher const & end) : parser_(parser) {
+		parser_.closing_ += end.closing_bracket();
+	}
+	~ClosingGuard() { parser_.closing_.pop_back(); }
+	ClosingGuard(ClosingGuard const &) = delete;
+	ClosingGuard & operator = (ClosingGuard const &) = delete;
+private:
+	Parser & parser_;
+};
+
+// Removes the spine of an expression from Parser::spine_ when done with it,
+// and the depth added by its binary operators.
+class SpineGuard {
+public:
+	explicit SpineGuard(Parser & parser)
+		: parser_(parser), depth_(parser.depth_), deepest_(parser.deepest_), base(parser.spine_.size())
+	{
+		parser_.deepest_ = parser_.depth_;
+	}
+	~SpineGuard() {
+		parser_.spine_.resize(base);
+		parser_.depth_ = depth_;
+		if (deepest_ > parser_.deepest_) parser_.deepest_ = deepest_;
+	}
+	SpineGuard(SpineGuard const &) = delete;
+	SpineGuard & operator = (SpineGuard const &) = delete;
+private:
+	Parser & parser_;
+	std::size_t const depth_;
+	std::size_t const deepest_;
+public:
+	std::size_t const base;
+};
+
 std::optional<string_view> Parser::parse_end(Matcher const & end, bool consume) {
 	auto m = end.try_parse(source_, consume);
 	if (!m && source_.empty()) {
@@ -147,10 +321,72 @@ std::optional<string_view> Parser::parse_end(Matcher const & end, bool consume)
 	return m;
 }
 
+std::unique_ptr<ErrorExpression> Parser::recover(ParseError && error, char const * begin, bool to_end) {
+	// An error at the same place as the previous one is most likely caused
+	// by it, like a missing `}' after a missing `]' at the end of the file.
+	char const * where = error.where.data();
+	if (errors_.empty() || errors_.back().where.data() != where) {
+		errors_.push_back(std::move(error));
+	}
+	string_view rest(begin, source_.data() + source_.size() - begin);
+	auto end = to_end ? rest.size() : find_element_end(rest);
+	// A closing bracket that is the error itself doesn't end anything, so
+	// is skipped as part of the element.
+	while (end < rest.size() && rest.data() + end == where && (rest[end] == ')' || rest[end] == ']' || rest[end] == '}')) {
+		end += 1 + find_element_end(rest.substr(end + 1));
+	}
+	auto skipped = rest.substr(0, end);
+	skip_whitespace(skipped, true);
+	while (!skipped.empty() && isspace(skipped.back())) skipped.remove_suffix(1);
+	source_ = rest.substr(end);
+	return make<ErrorExpression>(skipped);
+}
+
+char const * Parser::element_end() const {
+	// Before the `,', `;' or newline that ended the element, if consumed.
+	char const * end = source_.data();
+	switch (end[-1]) {
+		case ',': case ';': case '\n': return end - 1;
+	}
+	return end;
+}
+
+std::unique_ptr<ErrorExpression> Parser::recover_unclosed(
+	ParseError const & error, char const * begin, char const * end_of_last, Matcher const & end, bool & closed
+) {
+	closed = false;
+	if (closing_.size() < 2) return nullptr;
+	string_view rest(begin, source_.data() + source_.size() - begin);
+	auto i = find_element_end(rest, false);
+	if (i == rest.size() || rest[i] == closing_.back()) return nullptr;
+	if (closing_.find(rest[i]) == std::string::npos) return nullptr;
+	closed = true;
+	char const * bracket = rest.data() + i;
+	std::unique_ptr<ErrorExpression> element;
+	if (error.where.data() == bracket) {
+		// The element is cut short by the bracket, rather than wrong.
+		auto skipped = rest.substr(0, i);
+		skip_whitespace(skipped, true);
+		while (!skipped.empty() && isspace(skipped.back())) skipped.remove_suffix(1);
+		if (!skipped.empty()) element = make<ErrorExpression>(skipped);
+		end_of_last = bracket;
+	}
+	string_view at(end_of_last, 0);
+	if (errors_.empty() || errors_.back().where.data() != at.data()) errors_.push_back(end.error(at));
+	source_ = string_view(end_of_last, source_.data() + source_.size() - end_of_last);
+	return element;
+}
+
 bool Parser::is_identifier_start(char c) {
 	return isalpha(c) || c == '_';
 }
 
+bool Parser::is_identifier(string_view s) {
+	if (s.empty() || !is_identifier_start(s[0])) return false;
+	parse_identifier(s);
+	return s.empty();
+}
+
 string_view Parser::parse_identifier(string_view & source) {
 	auto const original_source = source;
 	while (!source.empty() && (isalpha(source[0]) || source[0] == '_' || isdigit(source[0]))) {
@@ -159,176 +395,86 @@ string_view Parser::parse_identifier(string_view & source) {
 	return original_source.substr(0, original_source.size() - source.size());
 }
 
-namespace {
-
-int digit_value(char c) {
-	switch (c) {
-		case '0': case '1': case '2': case '3': case '4':
-		case '5': case '6': case '7': case '8': case '9':
-			return c - '0';
-		case 'a': case 'A': return 10;
-		case 'b': case 'B': return 11;
-		case 'c': case 'C': return 12;
-		case 'd': case 'D': return 13;
-		case 'e': case 'E': return 14;
-		case 'f': case 'F': return 15;
-		default:
-			return -1;
-	}
-}
-
-int parse_hex_digit(string_view & s) {
-	if (!s.empty()) {
-		int value = digit_value(s[0]);
-		if (value != -1) {
-			s.remove_prefix(1);
-			return value;
-		}
-	}
-	throw ParseError("expected hexadecimal digit (0-9, a-f, A-F)", s.substr(0, 0));
-}
-
-size_t encode_utf8(char32_t codepoint, char (& buffer)[4]) {
-	if (codepoint < 0x7F) {
-		buffer[0] = codepoint;
-		return 1;
-	} else if (codepoint < 0x7FF) {
-		buffer[0] = 0xC0 | codepoint >> 6;
-		buffer[1] = 0x80 | (codepoint & 0x3F);
-		return 2;
-	} else if (codepoint < 0xFFFF) {
-		buffer[0] = 0xE0 | codepoint >> 12;
-		buffer[1] = 0x80 | (codepoint >> 6 & 0x3F);
-		buffer[2] = 0x80 | (codepoint & 0x3F);
-		return 3;
-	} else if (codepoint < 0x1FFFFF) {
-		buffer[0] = 0xF0 | codepoint >> 18;
-		buffer[1] = 0x80 | (codepoint >> 12 & 0x3F);
-		buffer[2] = 0x80 | (codepoint >> 6 & 0x3F);
-		buffer[3] = 0x80 | (codepoint & 0x3F);
-		return 4;
-	} else {
-		return 0;
-	}
-}
-
-}
-
 std::unique_ptr<StringLiteralExpression> Parser::parse_string_literal() {
+	if (options_.lazy_string_literals || !string_tracker_) return parse_lazy_string_literal();
+
 	auto const original_source = source_;
 
 	char const quote = source_[0];
 	source_.remove_prefix(1);
 
-	auto string_builder = string_tracker_.builder();
+	auto const contents = source_;
+	auto string_builder = string_tracker_->builder();
 	string_view value;
+	bool non_ascii_bytes = false;
 
 	while (true) {
-		value = source_.substr(0, 0);
-		while (!source_.empty() && source_[0] != quote && source_[0] != '\\') {
-			source_.remove_prefix(1);
-		}
-		value = string_view(value.data(), source_.data() - value.data());
+		value = source_.substr(0, find_quote_or_backslash(source_, quote));
+		source_.remove_prefix(value.size());
 		if (source_.empty()) {
 			throw ParseError("unterminated string literal", original_source);
 		} else if (source_[0] == quote) {
 			source_.remove_prefix(1);
 			break;
 		} else {
-			assert(source_[0] == '\\');
 			if (!value.empty()) string_builder.append(value, value);
-
-			if (source_.size() < 2) throw ParseError("incomplete escape sequence", source_);
-			switch (source_[1]) {
-				case '\\': case '"':
-				case 't': case 'n': case 'r':
-				case 'b': case 'a': case 'e':
-				case 'f': case 'v': {
-					string_view replacement;
-					switch (source_[1]) {
-						case '\\': replacement = "\\"; break;
-						case '"': replacement = "\""; break;
-						case 't': replacement = "\t"; break;
-						case 'n': replacement = "\n"; break;
-						case 'r': replacement = "\r"; break;
-						case 'b': replacement = "\b"; break;
-						case 'a': replacement = "\a"; break;
-						case 'e': replacement = "\033"; break;
-						case 'f': replacement = "\f"; break;
-						case 'v': replacement = "\v"; break;
-					}
-					string_builder.append(replacement, source_.substr(0, 2));
-					source_.remove_prefix(2);
-					break;
-				}
-				case '\n':
-					source_.remove_prefix(2);
-					break;
-				case 'x': {
-					// 8-bit byte in hex
-					auto escape_sequence = source_.substr(0, 4);
-					source_.remove_prefix(2);
-					int a = parse_hex_digit(source_);
-					int b = parse_hex_digit(source_);
-					char ch = a << 4 | b;
-					string_builder.append(string_view(&ch, 1), escape_sequence);
-					break;
-				}
-				case 'u':
-				case 'U': {
-					// 16-bit ('u') or 32-bit ('U') unicode codepoint in hex
-					int n_digits = source_[1] == 'u' ? 4 : 8;
-					auto escape_sequence = source_.substr(0, 2 + n_digits);
-					source_.remove_prefix(2);
-					char32_t codepoint = 0;
-					for (int i = 0; i < n_digits; ++i) {
-						codepoint <<= 4;
-						codepoint |= parse_hex_digit(source_);
-					}
-					char buffer[4];
-					if (size_t n_bytes = encode_utf8(codepoint, buffer)) {
-						string_builder.append(string_view(buffer, n_bytes), escape_sequence);
-					} else {
-						throw ParseError(
-							"invalid unicode codepoint",
-							escape_sequence
-						);
-					}
-					break;
-				}
-				case '0': case '1': case '2': case '3':
-				case '4': case '5': case '6': case '7': {
-					// 8-bit byte in octal (1-3 digits)
-					auto escape_sequence_start = source_.data();
-					int value = source_[1] - '0';
-					source_.remove_prefix(2);
-					int n_digits = 1;
-					while (n_digits < 3 && !source_.empty() && source_[0] >= '0' && source_[0] <= '7') {
-						value <<= 3;
-						value |= source_[0] - '0';
-						++n_digits;
-						source_.remove_prefix(1);
-					}
-					string_view escape_sequence(escape_sequence_start, source_.data() - escape_sequence_start);
-					if (value > 255) throw ParseError("octal escape sequence out of range", escape_sequence);
-					char ch = value;
-					string_builder.append(string_view(&ch, 1), escape_sequence);
-					break;
-				}
-				default:
-					throw ParseError("invalid escape sequence", source_.substr(0, 2));
+			char buffer[4];
+			auto escape_sequence = parse_escape_sequence(source_, buffer);
+			non_ascii_bytes |= escape_sequence.non_ascii_byte;
+			if (!escape_sequence.value.empty()) {
+				string_builder.append(escape_sequence.value, escape_sequence.source);
 			}
 		}
 	}
 
+	if (non_ascii_bytes) check_byte_escapes(contents.substr(0, source_.data() - contents.data() - 1));
+
 	if (!string_builder.empty()) {
 		// String literal contained escape sequences,
 		// so the literal value is not a substring of the source.
 		string_builder.append(value, value);
 		value = string_builder.build();
+		allocated(value.size());
+	}
+
+	return make<StringLiteralExpression>(value);
+}
+
+std::unique_ptr<StringLiteralExpression> Parser::parse_lazy_string_literal() {
+	auto const original_source = source_;
+
+	char const quote = source_[0];
+	source_.remove_prefix(1);
+
+	auto const contents = source_;
+	bool has_escapes = false;
+	bool non_ascii_bytes = false;
+
+	while (true) {
+		source_.remove_prefix(find_quote_or_backslash(source_, quote));
+		if (source_.empty()) {
+			throw ParseError("unterminated string literal", original_source);
+		} else if (source_[0] == quote) {
+			source_.remove_prefix(1);
+			break;
+		} else {
+			// Only check the escape sequence, decoding happens later.
+			has_escapes = true;
+			char buffer[4];
+			non_ascii_bytes |= parse_escape_sequence(source_, buffer).non_ascii_byte;
+		}
+	}
+
+	auto value = contents.substr(0, source_.data() - contents.data() - 1);
+	if (non_ascii_bytes) check_byte_escapes(value);
+
+	if (has_escapes) {
+		// Decoding will need at most this much.
+		allocated(value.size());
+		return node(StringLiteralExpression::escaped(value));
 	}
 
-	return std::make_unique<StringLiteralExpression>(value);
+	return make<StringLiteralExpression>(value);
 }
 
 std::unique_ptr<Expression> Parser::parse_number() {
@@ -389,13 +535,13 @@ std::unique_ptr<Expression> Parser::parse_number() {
 				value = v;
 			}
 		}
-		return std::make_unique<IntegerLiteralExpression>(int64_t(value));
+		return make<IntegerLiteralExpression>(int64_t(value));
 	} else {
 		if (base == 8) throw ParseError(
 			"floating point literals must be in decimal or hexadecimal, not in octal",
 			literal_source
 		);
-		return std::make_unique<DoubleLiteralExpression>(std::strtod(std::string(literal_source).data(), nullptr));
+		return make<DoubleLiteralExpression>(std::strtod(std::string(literal_source).data(), nullptr));
 	}
 }
 
@@ -464,8 +610,11 @@ Operator binary_operator(string_view op) {
 }
 
 std::unique_ptr<Expression> Parser::parse_expression_atom(Matcher const & end) {
+	++steps_;
 	if (parse_end(end, false)) return nullptr;
 
+	DepthGuard depth_guard(*this);
+
 	if (source_[0] == '(') {
 		auto open = source_.substr(0, 1);
 		source_.remove_prefix(1);
@@ -488,10 +637,21 @@ std::unique_ptr<Expression> Parser::parse_expression_atom(Matcher const & end) {
 			"missing expression after unary `" + std::string(op_source) + "' operator",
 			string_view(op_source.data(), source_.data() - op_source.data() + 1)
 		);
-		return std::make_unique<OperatorExpression>(op, op_source, nullptr, std::move(subexpr));
+		return make<OperatorExpression>(op, op_source, nullptr, std::move(subexpr));
 
 	} else if (is_identifier_start(source_[0])) {
-		return parse_identifier_expression(source_);
+		auto identifier = parse_identifier_expression(source_);
+		if (identifier->identifier == "import") {
+			// Only an import if followed by a string literal, so `import'
+			// can still be used as an identifier.
+			auto rest = source_;
+			skip_whitespace(rest, false);
+			if (!rest.empty() && rest[0] == '"') {
+				source_ = rest;
+				return parse_import(identifier->identifier);
+			}
+		}
+		return node(std::move(identifier));
 
 	} else if (source_[0] == '{') {
 		auto open = source_.substr(0, 1);
@@ -510,7 +670,7 @@ std::unique_ptr<Expression> Parser::parse_expression_atom(Matcher const & end) {
 		return parse_number();
 
 	} else if (source_[0] == '\\') {
-		throw ParseError("lambdas are not yet implemented", source_.substr(0, 1));
+		return parse_lambda(end);
 
 	} else {
 		throw ParseError("expected expression", source_.substr(0, 0));
@@ -519,8 +679,80 @@ std::unique_ptr<Expression> Parser::parse_expression_atom(Matcher const & end) {
 
 }
 
-bool Parser::parse_more_expression(std::unique_ptr<Expression> & expr, Matcher const & end) {
-	if (parse_end(end)) return false;
+std::unique_ptr<LambdaExpression> Parser::parse_lambda(Matcher const & end) {
+	source_.remove_prefix(1); // the backslash
+
+	Matcher const arrow("->");
+	Matcher const comma(",");
+
+	std::vector<string_view> parameters;
+	std::unordered_set<string_view> seen;
+	auto arrow_source = arrow.try_parse(source_);
+	while (!arrow_source) {
+		++steps_;
+		skip_whitespace(source_, true);
+		auto name = source_.empty() || !is_identifier_start(source_[0]) ? string_view() : parse_identifier(source_);
+		if (name.empty()) throw ParseError(
+			parameters.empty() ? "expected parameter name or `->'" : "expected parameter name",
+			source_.substr(0, 0)
+		);
+		auto [p, inserted] = seen.insert(name);
+		if (!inserted) throw ParseError(
+			"duplicate parameter `" + std::string(name) + "'",
+			name,
+			{{"previous parameter `" + std::string(name) + "' here", *p}}
+		);
+		push_back(parameters, name);
+		arrow_source = arrow.try_parse(source_);
+		if (!arrow_source && !comma.try_parse(source_)) throw ParseError(
+			"expected `,' or `->'",
+			source_.substr(0, 0)
+		);
+	}
+
+	// The body extends as far as possible, up to (but not including)
+	// the end of the expression the lambda is part of.
+	SpineGuard spine(*this);
+	auto body = parse_expression_atom(end);
+	if (body) {
+		extend_spine(*body, spine.base);
+		while (parse_more_expression(body, spine.base, end, false));
+	}
+	if (!body) throw ParseError(
+		"missing expression after `->'",
+		string_view(arrow_source->data(), source_.data() - arrow_source->data() + 1)
+	);
+
+	return make<LambdaExpression>(std::move(parameters), std::move(body));
+}
+
+std::unique_ptr<ImportExpression> Parser::parse_import(string_view keyword) {
+	refcount_ptr<StringLiteralExpression const> path = parse_string_literal();
+	auto source = string_view(keyword.data(), source_.data() - keyword.data());
+	return make<ImportExpression>(source, std::move(path));
+}
+
+void Parser::extend_spine(Expression & expr, std::size_t spine) {
+	auto e = dynamic_cast<OperatorExpression *>(&expr);
+	while (e && !e->parenthesized) {
+		push_spine(*e, spine);
+		assert(e->rhs.unique());
+		e = dynamic_cast<OperatorExpression *>(e->rhs.unique());
+	}
+}
+
+void Parser::push_spine(OperatorExpression & e, std::size_t spine) {
+	OperatorExpression const * binding = &e;
+	if (spine_.size() > spine) {
+		auto above = spine_.back().binding;
+		if (get_precedence(above->op) < get_precedence(e.op)) binding = above;
+	}
+	spine_.push_back({&e, binding});
+}
+
+bool Parser::parse_more_expression(std::unique_ptr<Expression> & expr, std::size_t spine, Matcher const & end, bool consume_end) {
+	++steps_;
+	if (parse_end(end, consume_end)) return false;
 
 	switch (source_[0]) {
 		case ':':
@@ -573,9 +805,10 @@ bool Parser::parse_more_expression(std::unique_ptr<Expression> & expr, Matcher c
 			refcount_ptr<Expression const> rhs;
 
 			if (op_source == "[" || op_source == "(") {
+				DepthGuard depth_guard(*this);
 				rhs = parse_list(Matcher(MatchMode::matching_bracket, op_source == "[" ? "]" : ")", op_source));
 			} else if (op == Operator::dot) {
-				rhs = parse_identifier_expression(source_);
+				rhs = node(parse_identifier_expression(source_));
 				if (!rhs) throw ParseError(
 					"expected identifier after `.'",
 					string_view(op_source.data(), source_.data() - op_source.data() + 1)
@@ -588,20 +821,22 @@ bool Parser::parse_more_expression(std::unique_ptr<Expression> & expr, Matcher c
 				);
 			}
 
-			refcount_ptr<Expression const> rexpr(std::move(expr));
-
 			// Find the expression to use as left hand side.
 			// Often it is the entire expression expr,
 			// but depending on the precedence of operators,
 			// it might be just a subexpresssion of expr.
-			refcount_ptr<Expression const> * lhs = &rexpr;
-			while (true) {
-				assert(lhs->unique());
-				auto e = dynamic_cast<OperatorExpression *>(lhs->unique());
-				if (!e) break;
-				if (e->parenthesized) break;
+			//
+			// The binding operators lower on the spine bind at least as
+			// tightly as the ones above them, so this searches from the
+			// bottom. The ones that bind more tightly than this operator end
+			// up in its left hand side, and so are never searched again.
+			// Searching from the top instead would take quadratic time for
+			// `a ** b ** ...'.
+			while (spine_.size() > spine) {
+				++steps_;
+				auto e = spine_.back().binding;
 				auto p = higher_precedence(e->op, op);
-				if (p == order::left) break;
+				if (p == order::right) break;
 				if (p == order::unordered) throw ParseError(
 					"operator `" + std::string(e->op_source) + "' " +
 						(op == e->op ? "" : "has equal precedence as `" + std::string(op_source) + "' and ") +
@@ -609,11 +844,28 @@ bool Parser::parse_more_expression(std::unique_ptr<Expression> & expr, Matcher c
 					e->op_source,
 					{{"conflicting `" + std::string(op_source) + "' here", op_source}}
 				);
-				lhs = &e->rhs;
+				spine_.pop_back();
 			}
 
+			// The new operator can push everything in expr one level down,
+			// and everything parsed after it is below it.
+			if (++deepest_ > options_.limits.max_depth) throw ParseLimitError(
+				"nesting deeper than " + std::to_string(options_.limits.max_depth) + " levels",
+				op_source
+			);
+			if (deepest_ > max_depth_) max_depth_ = deepest_;
+			++depth_;
+
+			// Only taken after the checks above, so an error leaves expr
+			// intact (see ParseOptions::recover).
+			refcount_ptr<Expression const> rexpr(std::move(expr));
+			refcount_ptr<Expression const> * lhs = spine_.size() == spine ? &rexpr : &spine_.back().expr->rhs;
+
 			// Replace the expression by an operator_expression that uses it as the left hand side.
-			*lhs = std::make_unique<OperatorExpression>(op, op_source, std::move(*lhs), std::move(rhs));
+			auto e = make<OperatorExpression>(op, op_source, std::move(*lhs), std::move(rhs));
+			push_spine(*e, spine);
+			if (auto r = e->rhs.unique()) extend_spine(*r, spine);
+			*lhs = std::move(e);
 
 			expr = rexpr.release_unique();
 			assert(expr);
@@ -629,46 +881,110 @@ bool Parser::parse_more_expression(std::unique_ptr<Expression> & expr, Matcher c
 }
 
 std::unique_ptr<Expression> Parser::parse_expression(Matcher const & end) {
-	auto expr = parse_expression_atom(end);
-	if (expr) while (parse_more_expression(expr, end));
+	char const * begin = source_.data();
+	std::unique_ptr<Expression> expr;
+	try {
+		SpineGuard spine(*this);
+		expr = parse_expression_atom(end);
+		if (expr) {
+			extend_spine(*expr, spine.base);
+			while (parse_more_expression(expr, spine.base, end));
+		}
+	} catch (ParseLimitError &) {
+		throw;
+	} catch (ParseError & e) {
+		// Errors in elements of objects and lists are recovered from in
+		// parse_object() and parse_list(), and only those at the top level
+		// here. What was parsed before the error is kept.
+		if (!options_.recover || !end.is_end_of_file()) throw;
+		auto error = recover(std::move(e), begin, true);
+		if (!expr) expr = std::move(error);
+	}
 	return expr;
 }
 
 std::unique_ptr<ObjectExpression> Parser::parse_object(Matcher const & end) {
+	ClosingGuard closing(*this, end);
 	std::vector<refcount_ptr<Expression const>> keys;
 	std::vector<refcount_ptr<Expression const>> values;
+	char const * end_of_last = source_.data();
 	while (true) {
-		if (parse_end(end)) break;
-		auto name = parse_identifier(source_);
-		if (name.empty()) throw ParseError("expected identifier or " + end.description(), source_.substr(0, 0));
-		auto eq = Matcher("=").parse(source_);
-		auto value = parse_expression(Matcher(MatchMode::object_element).or_before(end));
-		if (!value) throw ParseError(
-			"missing expression after `='",
-			string_view(eq.data(), source_.data() - eq.data() + 1)
-		);
-		keys.push_back(std::make_unique<StringLiteralExpression>(name));
-		values.push_back(std::move(value));
+		// The element, or its value once past the `='.
+		char const * begin = source_.data();
+		string_view name;
+		try {
+			if (parse_end(end)) break;
+			name = parse_identifier(source_);
+			if (name.empty()) throw ParseError("expected identifier or " + end.description(), source_.substr(0, 0));
+			auto eq = Matcher("=").parse(source_);
+			begin = source_.data();
+			auto value = parse_expression(Matcher(MatchMode::object_element).or_before(end));
+			if (!value) throw ParseError(
+				"missing expression after `='",
+				string_view(eq.data(), source_.data() - eq.data() + 1)
+			);
+			push_back(keys, make<StringLiteralExpression>(name));
+			push_back(values, std::move(value));
+			end_of_last = element_end();
+		} catch (ParseLimitError &) {
+			throw;
+		} catch (ParseError & e) {
+			if (!options_.recover) throw;
+			bool closed;
+			auto element = recover_unclosed(e, begin, end_of_last, end, closed);
+			if (closed) {
+				if (element && !name.empty()) {
+					push_back(keys, make<StringLiteralExpression>(name));
+					push_back(values, std::move(element));
+				}
+				break;
+			}
+			auto error = recover(std::move(e), begin);
+			if (!name.empty()) {
+				push_back(keys, make<StringLiteralExpression>(name));
+				push_back(values, std::move(error));
+			}
+			if (source_.empty()) break;
+			Matcher(MatchMode::object_element).try_parse(source_, true, false);
+		}
 	}
-	return std::make_unique<ObjectExpression>(
-		std::make_unique<ListExpression>(std::move(keys)),
-		std::make_unique<ListExpression>(std::move(values))
+	return make<ObjectExpression>(
+		make<ListExpression>(std::move(keys)),
+		make<ListExpression>(std::move(values))
 	);
 }
 
 std::unique_ptr<ListExpression> Parser::parse_list(Matcher const & end) {
+	ClosingGuard closing(*this, end);
 	std::vector<refcount_ptr<Expression const>> elements;
+	char const * end_of_last = source_.data();
 	while (true) {
 		char const * expression_begin = source_.data();
-		if (parse_end(end)) break;
-		auto value = parse_expression(Matcher(MatchMode::object_element).or_before(end));
-		if (!value) throw ParseError(
-			"missing expression",
-			string_view(expression_begin, source_.data() - expression_begin + 1)
-		);
-		elements.push_back(std::move(value));
+		try {
+			if (parse_end(end)) break;
+			auto value = parse_expression(Matcher(MatchMode::object_element).or_before(end));
+			if (!value) throw ParseError(
+				"missing expression",
+				string_view(expression_begin, source_.data() - expression_begin + 1)
+			);
+			push_back(elements, std::move(value));
+			end_of_last = element_end();
+		} catch (ParseLimitError &) {
+			throw;
+		} catch (ParseError & e) {
+			if (!options_.recover) throw;
+			bool closed;
+			auto element = recover_unclosed(e, expression_begin, end_of_last, end, closed);
+			if (closed) {
+				if (element) push_back(elements, std::move(element));
+				break;
+			}
+			push_back(elements, recover(std::move(e), expression_begin));
+			if (source_.empty()) break;
+			Matcher(MatchMode::object_element).try_parse(source_, true, false);
+		}
 	}
-	return std::make_unique<ListExpression>(std::move(elements));
+	return make<ListExpression>(std::move(elements));
 }
 
 }
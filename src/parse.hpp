@@ -1,5 +1,8 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <stdexcept>
@@ -20,36 +23,181 @@ public:
 	using Error::Error;
 };
 
+// Thrown when parsing exceeds one of the ParseLimits.
+class ParseLimitError : public ParseError {
+public:
+	using ParseError::ParseError;
+};
+
 class Matcher;
 
 extern Matcher match_end_of_file;
 
+// Limits on the work a single parse may do, for parsing untrusted input.
+// By default, nothing is limited.
+struct ParseLimits {
+	std::size_t max_source_bytes = std::numeric_limits<std::size_t>::max();
+
+	// Number of expressions in the resulting tree.
+	std::size_t max_nodes = std::numeric_limits<std::size_t>::max();
+
+	// Bytes allocated for expressions, list storage and decoded strings.
+	std::size_t max_allocated_bytes = std::numeric_limits<std::size_t>::max();
+
+	// Nesting of brackets and operators, which limits the height of the
+	// resulting tree. Every binary operator counts as a level for the rest
+	// of the expression it is part of, so `a + b + c' is three levels deep.
+	// Most functions walking a tree, like resolve(), recurse once per level,
+	// so untrusted input should be parsed with a limit.
+	std::size_t max_depth = std::numeric_limits<std::size_t>::max();
+
+	// Measured from the construction of the Parser.
+	std::chrono::steady_clock::duration max_time = std::chrono::steady_clock::duration::max();
+};
+
+// The work done by a Parser so far.
+struct ParseStats {
+	// Parsed atoms and operators, and the steps taken to find where an
+	// operator goes in the tree. A measure of time that does not depend on
+	// the machine.
+	std::size_t steps = 0;
+	std::size_t nodes = 0;
+	std::size_t allocated_bytes = 0;
+	std::size_t max_depth = 0;
+};
+
+struct ParseOptions {
+	// Keep string literals with escape sequences as their source, and only
+	// decode them when their value is used for the first time.
+	bool lazy_string_literals = false;
+
+	// Keep going after a syntax error, to find all of them at once. The
+	// element of the object or list that contains the error is skipped, up
+	// to the next `,', `;' or newline, or the closing bracket, and becomes
+	// an ErrorExpression. At the top level, the rest of the source is
+	// skipped. The errors are available through Parser::errors() instead of
+	// being thrown. ParseLimitErrors are still thrown.
+	bool recover = false;
+
+	ParseLimits limits;
+};
+
+// Parses UTF-8 source. The values of all string literals are valid UTF-8.
 class Parser {
 
 public:
-	explicit Parser(string_tracker & tracker, std::string_view source)
-		: string_tracker_(tracker), source_(source) {}
+	explicit Parser(string_tracker & tracker, std::string_view source, ParseOptions options = {});
+
+	// Parses untracked: without a string_tracker, so no source mappings
+	// are recorded, and with no limit on the size of the source beyond
+	// ParseLimits. String literals are decoded lazily, and all locations in the
+	// resulting tree and in errors are views into the given source, which
+	// must stay alive (e.g. mapped) for as long as those are used. This
+	// saves the memory of the mappings, not that of the source itself.
+	explicit Parser(std::string_view source, ParseOptions options = {});
 
 	std::unique_ptr<Expression> parse_expression(Matcher const & end = match_end_of_file);
 	std::unique_ptr<ListExpression> parse_list(Matcher const & end = match_end_of_file);
 	std::unique_ptr<ObjectExpression> parse_object(Matcher const & end = match_end_of_file);
 
+	ParseStats stats() const { return {steps_, nodes_, allocated_bytes_, max_depth_}; }
+
+	// The errors recovered from (see ParseOptions::recover), in order.
+	std::vector<ParseError> const & errors() const { return errors_; }
+
 	static bool is_identifier_start(char c);
+	static bool is_identifier(std::string_view);
 	static std::string_view parse_identifier(std::string_view & source);
 	static std::unique_ptr<IdentifierExpression> parse_identifier_expression(std::string_view & source);
 
 private:
 	std::unique_ptr<Expression> parse_expression_atom(Matcher const & end);
-	bool parse_more_expression(std::unique_ptr<Expression> & expr, Matcher const & end);
-
+	// 'spine' is where the spine of expr starts in spine_.
+	bool parse_more_expression(std::unique_ptr<Expression> & expr, std::size_t spine, Matcher const & end, bool consume_end = true);
+	// Pushes the expression onto spine_, and then its right hand side, and
+	// so on, for as long as they are operators that aren't parenthesized.
+	void extend_spine(Expression &, std::size_t spine);
+	void push_spine(OperatorExpression &, std::size_t spine);
+
+	std::unique_ptr<LambdaExpression> parse_lambda(Matcher const & end);
+	std::unique_ptr<ImportExpression> parse_import(std::string_view keyword);
 	std::unique_ptr<StringLiteralExpression> parse_string_literal();
+	std::unique_ptr<StringLiteralExpression> parse_lazy_string_literal();
 	std::unique_ptr<Expression> parse_number();
 
 	std::optional<std::string_view> parse_end(Matcher const &, bool consume = true);
 
+	// Keeps the error, and skips to the end of the element of an object or
+	// list that starts at 'begin', or to the end of the source. Returns what
+	// was skipped.
+	std::unique_ptr<ErrorExpression> recover(ParseError &&, char const * begin, bool to_end = false);
+
+	// Called instead of recover() for an element of a list or object that
+	// is missing its closing bracket, because the first unmatched closing
+	// bracket after 'begin' closes an enclosing list or object instead.
+	// Sets 'closed' if so, after reporting the missing bracket, and moving
+	// back to 'end_of_last', the end of the last element that was parsed.
+	// The enclosing list or object continues from there. If the error is
+	// the bracket itself, the element is cut short by it, and is returned
+	// to be kept.
+	std::unique_ptr<ErrorExpression> recover_unclosed(
+		ParseError const &, char const * begin, char const * end_of_last, Matcher const & end, bool & closed
+	);
+
+	// The end of the element of a list or object that was just parsed.
+	char const * element_end() const;
+
+	// Throws a ParseError at the first byte of the source that is not valid
+	// UTF-8.
+	void check_encoding();
+
+	// Resource accounting for ParseLimits.
+	void check_limits();
+	void allocated(std::size_t bytes);
+	template<typename T> std::unique_ptr<T> node(std::unique_ptr<T>);
+	template<typename T, typename... Args> std::unique_ptr<T> make(Args &&...);
+	template<typename T, typename U> void push_back(std::vector<T> &, U &&);
+
+	friend class DepthGuard;
+	friend class SpineGuard;
+	friend class ClosingGuard;
+
 private:
-	string_tracker & string_tracker_;
+	string_tracker * string_tracker_;
 	std::string_view source_;
+	ParseOptions options_;
+
+	std::size_t nodes_ = 0;
+	std::size_t allocated_bytes_ = 0;
+	std::size_t depth_ = 0;
+	std::size_t max_depth_ = 0;
+	// The deepest level reached in the expression being parsed.
+	std::size_t deepest_ = 0;
+	std::size_t steps_ = 0;
+	std::chrono::steady_clock::time_point deadline_;
+
+	// The operators along the right edge of the expressions being parsed,
+	// from the root down, which are the places where the next binary
+	// operator can go. Nested expressions are on top of the ones they are
+	// part of.
+	//
+	// Along with each operator, the most tightly binding operator on the
+	// way to it from the root of its expression, which decides whether the
+	// next operator goes below it. An operator can bind less tightly than
+	// the ones above it, like the `-' in `a : -b', which makes no
+	// difference for where the next operator goes: `a : -b : c' is
+	// `(a : -b) : c'.
+	struct SpineEntry {
+		OperatorExpression * expr;
+		OperatorExpression const * binding;
+	};
+	std::vector<SpineEntry> spine_;
+
+	std::vector<ParseError> errors_;
+
+	// The closing brackets of the lists and objects being parsed, from the
+	// outermost in, or 0 for those not in brackets.
+	std::string closing_;
 
 };
 
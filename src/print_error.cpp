@@ -1,75 +1,147 @@
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <string_view>
 
 #include <string_tracker.hpp>
 
 #include "print_error.hpp"
+#include "source_range.hpp"
 
 using string_pool::string_tracker;
 
 namespace conftaal {
 
-void print_source_snippet(string_tracker::get_result const & src, string_tracker::get_result const & src_end, bool color) {
-	if (src.location.column == 0 || src.original_char - &src.original_source[0] >= src.location.column - 1) {
-		char const * bad_line_start = src.original_char - (src.location.column - 1);
+void format_source_snippet(
+	std::string & out,
+	std::string_view original_source,
+	char const * begin,
+	char const * end,
+	std::size_t column,
+	bool color
+) {
+	if (column == 0 || begin - &original_source[0] >= column - 1) {
+		char const * bad_line_start = begin - (column - 1);
 		std::string pointer_line;
-		char const * original_source_end = src.original_source.data() + src.original_source.size();
+		char const * original_source_end = original_source.data() + original_source.size();
 		for (char const * c = bad_line_start; ; ++c) {
-			if (c == src.original_char || (c > src.original_char && c < src_end.original_char)) {
+			if (c == begin || (c > begin && c < end)) {
 				pointer_line += '^';
 			} else {
 				pointer_line += ' ';
 			}
 			if (c == original_source_end || *c == '\n') break;
 			if (*c == '\t') {
-				std::clog << ' ';
+				out += ' ';
 				while (pointer_line.size() % 8 != 0) {
 					pointer_line.push_back(pointer_line.back());
-					std::clog << ' ';
+					out += ' ';
 				}
 			} else {
-				std::clog << *c;
+				out += *c;
 			}
 		}
 		while (!pointer_line.empty() && pointer_line.back() == ' ') pointer_line.pop_back();
 		if (bad_line_start == original_source_end) {
-			if (color) std::clog << "\033[34m";
-			std::clog << "<end of file>";
-			if (color) std::clog << "\033[m";
+			if (color) out += "\033[34m";
+			out += "<end of file>";
+			if (color) out += "\033[m";
 		}
-		std::clog << std::endl;
-		if (color) std::clog << "\033[1;32m";
-		std::clog << pointer_line;
-		if (color) std::clog << "\033[m";
-		std::clog << std::endl;
+		out += '\n';
+		if (color) out += "\033[1;32m";
+		out += pointer_line;
+		if (color) out += "\033[m";
+		out += '\n';
 	}
 }
 
-void print_message(std::string_view message, string_tracker const & tracker, std::string_view where, bool color, bool error) {
-	auto bad_src = tracker.get(where);
-	if (color) std::clog << "\033[1m";
-	if (bad_src.location) std::clog << bad_src.location << ": ";
+void format_message(std::string & out, std::string_view location, std::string_view message, bool color, bool error) {
+	if (color) out += "\033[1m";
+	if (!location.empty()) {
+		out += location;
+		out += ": ";
+	}
 	if (error) {
-		if (color) std::clog << "\033[31m";
-		std::clog << "error: ";
-		if (color) std::clog << "\033[;1m";
+		if (color) out += "\033[31m";
+		out += "error: ";
+		if (color) out += "\033[;1m";
 	}
-	std::clog << message;
-	if (color) std::clog << "\033[m";
-	std::clog << std::endl;
+	out += message;
+	if (color) out += "\033[m";
+	out += '\n';
+}
+
+namespace {
+
+void format_located_message(std::string & out, std::string_view message, string_tracker const & tracker, std::string_view where, bool color, bool error) {
+	auto bad_src = tracker.get(where);
+	std::string location;
+	if (bad_src.location) {
+		std::ostringstream s;
+		s << bad_src.location;
+		location = s.str();
+	}
+	format_message(out, location, message, color, error);
 
 	if (bad_src.location) {
 		auto bad_src_end = tracker.get(where.data() + where.size());
-		print_source_snippet(bad_src, bad_src_end, color);
+		format_source_snippet(out, bad_src.original_source, bad_src.original_char, bad_src_end.original_char, bad_src.location.column, color);
+	}
+}
+
+void format_located_message(std::string & out, std::string_view message, std::string_view file_name, std::string_view source, std::string_view where, bool color, bool error) {
+	bool located = where.data() >= source.data() && where.data() <= source.data() + source.size();
+	auto range = located ? SourceRange::of(where, source) : SourceRange();
+	auto location = locate(source, range.offset);
+	format_message(
+		out,
+		located ? std::string(file_name) + ':' + std::to_string(location.line) + ':' + std::to_string(location.column) : "",
+		message,
+		color,
+		error
+	);
+
+	if (located) {
+		char const * begin = source.data() + range.offset;
+		format_source_snippet(out, source, begin, begin + range.size, location.column, color);
 	}
 }
 
+void write(std::string const & out) {
+	std::clog.write(out.data(), out.size());
+	std::clog.flush();
+}
+
+}
+
+void print_message(std::string_view message, string_tracker const & tracker, std::string_view where, bool color, bool error) {
+	std::string out;
+	format_located_message(out, message, tracker, where, color, error);
+	write(out);
+}
+
 void print_error(Error const & error, string_tracker const & tracker, bool color) {
-	print_message(error.what(), tracker, error.where, color, true);
+	std::string out;
+	format_located_message(out, error.what(), tracker, error.where, color, true);
+	for (auto const & note : error.notes) {
+		format_located_message(out, note.first, tracker, note.second, color, false);
+	}
+	write(out);
+}
+
+void print_message(std::string_view message, std::string_view file_name, std::string_view source, std::string_view where, bool color, bool error) {
+	std::string out;
+	format_located_message(out, message, file_name, source, where, color, error);
+	write(out);
+}
+
+void print_error(Error const & error, std::string_view file_name, std::string_view source, bool color) {
+	std::string out;
+	format_located_message(out, error.what(), file_name, source, error.where, color, true);
 	for (auto const & note : error.notes) {
-		print_message(note.first, tracker, note.second, color, false);
+		format_located_message(out, note.first, file_name, source, note.second, color, false);
 	}
+	write(out);
 }
 
 }
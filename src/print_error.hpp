@@ -1,3 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
 #include <string_view>
 
 #include <string_tracker.hpp>
@@ -16,4 +20,41 @@ void print_message(
 
 void print_error(Error const &, string_pool::string_tracker const &, bool color = true);
 
+// Same as above, but without a string_tracker, for use with sources parsed
+// without one. The locations must be views into the given source of the
+// named file, which is the source that was parsed.
+void print_message(
+	std::string_view message,
+	std::string_view file_name,
+	std::string_view source,
+	std::string_view where,
+	bool color = true,
+	bool error = false
+);
+
+void print_error(Error const &, std::string_view file_name, std::string_view source, bool color = true);
+
+// The building blocks of the functions above, which append to 'out'
+// instead of writing to std::clog.
+
+// Formats the first line of a message. The location is omitted if empty.
+void format_message(
+	std::string & out,
+	std::string_view location,
+	std::string_view message,
+	bool color = true,
+	bool error = false
+);
+
+// Formats the line of the original source that contains 'begin'
+// (at the given column), and a line pointing at 'begin' up to 'end'.
+void format_source_snippet(
+	std::string & out,
+	std::string_view original_source,
+	char const * begin,
+	char const * end,
+	std::size_t column,
+	bool color = true
+);
+
 }
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expression.hpp"
+#include "parse.hpp"
+#include "query.hpp"
+
+namespace conftaal {
+
+namespace {
+
+// The keys of an object are always string literals.
+string_view key_name(refcount_ptr<Expression const> const & key) {
+	return static_cast<StringLiteralExpression const &>(*key).value();
+}
+
+// The slot of the last key with the given name, or -1.
+std::ptrdiff_t find_key(ListExpression const & keys, string_view name) {
+	for (std::size_t i = keys.elements.size(); i-- > 0;) {
+		if (key_name(keys.elements[i]) == name) return i;
+	}
+	return -1;
+}
+
+}
+
+Path::Path(string_view path) : source_(path) {
+	// Errors point into path, as source_ is gone once the constructor throws.
+	string_view source = path;
+	while (true) {
+		if (!source.empty() && source[0] == '[') {
+			auto open = source.substr(0, 1);
+			source.remove_prefix(1);
+			auto digits = source.substr(0, std::find_if_not(source.begin(), source.end(), [] (char c) {
+				return std::isdigit(static_cast<unsigned char>(c));
+			}) - source.begin());
+			if (digits.empty()) throw ParseError("expected list index", source.substr(0, 0));
+			source.remove_prefix(digits.size());
+			if (source.empty() || source[0] != ']') throw ParseError(
+				"expected `]'",
+				source.substr(0, 0),
+				{{"... to match this `['", open}}
+			);
+			source.remove_prefix(1);
+			Step step;
+			if (std::from_chars(digits.data(), digits.data() + digits.size(), step.index).ec != std::errc()) {
+				throw ParseError("list index too large", digits);
+			}
+			steps_.push_back(std::move(step));
+		} else {
+			if (!steps_.empty()) {
+				if (source.empty()) break;
+				if (source[0] != '.') throw ParseError("expected `.' or `['", source.substr(0, 0));
+				source.remove_prefix(1);
+			}
+			auto name = Parser::parse_identifier(source);
+			if (name.empty()) throw ParseError("expected identifier", source.substr(0, 0));
+			Step step;
+			step.name = std::string(name);
+			steps_.push_back(std::move(step));
+		}
+	}
+}
+
+Expression const * Path::resolve(Expression const & root) const {
+	Expression const * e = &root;
+	for (auto const & step : steps_) {
+		if (!step.name.empty()) {
+			auto object = dynamic_cast<ObjectExpression const *>(e);
+			if (!object) return nullptr;
+			auto slot = find_key(*object->keys, step.name);
+			if (slot < 0) return nullptr;
+			e = object->values->elements[slot].get();
+		} else {
+			auto list = dynamic_cast<ListExpression const *>(e);
+			if (!list || step.index >= list->elements.size()) return nullptr;
+			e = list->elements[step.index].get();
+		}
+	}
+	return e;
+}
+
+AccessPlan::AccessPlan(Path path, Expression const & root) : path_(std::move(path)) {
+	Expression const * e = &root;
+	steps_.reserve(path_.steps().size());
+	for (auto const & step : path_.steps()) {
+		if (!step.name.empty()) {
+			auto object = dynamic_cast<ObjectExpression const *>(e);
+			if (!object) return;
+			auto slot = find_key(*object->keys, step.name);
+			if (slot < 0) return;
+			steps_.push_back({object->keys, std::size_t(slot)});
+			e = object->values->elements[slot].get();
+		} else {
+			auto list = dynamic_cast<ListExpression const *>(e);
+			if (!list || step.index >= list->elements.size()) return;
+			steps_.push_back({nullptr, step.index});
+			e = list->elements[step.index].get();
+		}
+	}
+	exists_ = true;
+}
+
+Expression const * AccessPlan::resolve(Expression const & root) const {
+	if (!exists_) return path_.resolve(root);
+	Expression const * e = &root;
+	for (auto const & step : steps_) {
+		if (step.keys) {
+			auto object = dynamic_cast<ObjectExpression const *>(e);
+			if (!object || object->keys != step.keys) return path_.resolve(root);
+			e = object->values->elements[step.slot].get();
+		} else {
+			auto list = dynamic_cast<ListExpression const *>(e);
+			if (!list || step.slot >= list->elements.size()) return nullptr;
+			e = list->elements[step.slot].get();
+		}
+	}
+	return e;
+}
+
+namespace {
+
+void resolve_remaining(
+	Expression const & e,
+	std::size_t depth,
+	std::vector<Path::Step> const * const * steps,
+	std::vector<std::size_t> const & ids,
+	std::vector<Expression const *> & results
+);
+
+}
+
+std::vector<Expression const *> resolve_all(Expression const & root, std::vector<Path> const & paths) {
+	std::vector<Expression const *> results(paths.size(), nullptr);
+	std::vector<std::vector<Path::Step> const *> steps;
+	std::vector<std::size_t> ids;
+	steps.reserve(paths.size());
+	ids.reserve(paths.size());
+	for (std::size_t i = 0; i < paths.size(); ++i) {
+		steps.push_back(&paths[i].steps());
+		ids.push_back(i);
+	}
+	resolve_remaining(root, 0, steps.data(), ids, results);
+	return results;
+}
+
+namespace {
+
+// Resolves the remaining steps (from 'depth') of the paths with the given ids.
+void resolve_remaining(
+	Expression const & e,
+	std::size_t depth,
+	std::vector<Path::Step> const * const * steps,
+	std::vector<std::size_t> const & ids,
+	std::vector<Expression const *> & results
+) {
+	// The paths that continue, grouped by their next step.
+	std::unordered_map<string_view, std::vector<std::size_t>> by_name;
+	std::unordered_map<std::size_t, std::vector<std::size_t>> by_index;
+
+	for (auto id : ids) {
+		auto const & s = *steps[id];
+		if (s.size() == depth) {
+			results[id] = &e;
+		} else if (!s[depth].name.empty()) {
+			by_name[s[depth].name].push_back(id);
+		} else {
+			by_index[s[depth].index].push_back(id);
+		}
+	}
+
+	if (!by_name.empty()) {
+		if (auto object = dynamic_cast<ObjectExpression const *>(&e)) {
+			auto const & keys = object->keys->elements;
+			// Last key wins, so scan backwards and take the first match.
+			for (std::size_t i = keys.size(); i-- > 0 && !by_name.empty();) {
+				auto group = by_name.find(key_name(keys[i]));
+				if (group != by_name.end()) {
+					resolve_remaining(*object->values->elements[i], depth + 1, steps, group->second, results);
+					by_name.erase(group);
+				}
+			}
+		}
+	}
+
+	if (!by_index.empty()) {
+		if (auto list = dynamic_cast<ListExpression const *>(&e)) {
+			for (auto const & group : by_index) {
+				if (group.first < list->elements.size()) {
+					resolve_remaining(*list->elements[group.first], depth + 1, steps, group.second, results);
+				}
+			}
+		}
+	}
+}
+
+}
+
+}
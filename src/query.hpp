@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "expression.hpp"
+
+namespace conftaal {
+
+// A path to a value in a tree of objects and lists, like
+// `servers.primary.ports[2]`, compiled once to be looked up many times.
+//
+// A name looks up a key in an object, and [n] looks up an element of a
+// list. When an object contains the same key multiple times, the last one
+// is used.
+class Path {
+public:
+	// Throws a ParseError pointing into the given path if it is invalid.
+	explicit Path(std::string_view path);
+
+	// Returns null if the path does not exist in the tree.
+	Expression const * resolve(Expression const & root) const;
+
+	std::string const & source() const { return source_; }
+
+	struct Step {
+		std::string name; // Empty for list indexes.
+		std::size_t index = 0;
+	};
+
+	std::vector<Step> const & steps() const { return steps_; }
+
+private:
+	std::string source_;
+	std::vector<Step> steps_;
+};
+
+// A Path resolved against the shape of a specific tree: which slot of each
+// object and which element of each list to take.
+//
+// Resolving it again does not compare any strings, as long as the objects
+// on the path still have the same (shared) key lists as when the plan was
+// made. Otherwise, it falls back to looking up the path by name.
+class AccessPlan {
+public:
+	AccessPlan(Path path, Expression const & root);
+
+	Expression const * resolve(Expression const & root) const;
+
+	Path const & path() const { return path_; }
+
+private:
+	struct Step {
+		// Null for list indexes, or if the path did not exist at all.
+		refcount_ptr<ListExpression const> keys;
+		std::size_t slot;
+	};
+
+	Path path_;
+	std::vector<Step> steps_;
+	bool exists_ = false;
+};
+
+// Resolves many paths in one walk over the tree, visiting every object and
+// list at most once, and scanning the keys of every object only once.
+std::vector<Expression const *> resolve_all(Expression const & root, std::vector<Path> const & paths);
+
+}
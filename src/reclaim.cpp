@@ -0,0 +1,107 @@
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "reclaim.hpp"
+
+namespace conftaal {
+
+namespace {
+
+// Moves the children of the expression onto the stack, so destroying the
+// expression itself doesn't destroy anything else.
+void detach_children(Expression & expr, std::vector<refcount_ptr<Expression const>> & stack) {
+	if (auto e = dynamic_cast<OperatorExpression *>(&expr)) {
+		if (e->lhs) stack.push_back(std::move(e->lhs));
+		stack.push_back(std::move(e->rhs));
+	} else if (auto e = dynamic_cast<ListExpression *>(&expr)) {
+		for (auto & element : e->elements) stack.push_back(std::move(element));
+		e->elements.clear();
+	} else if (auto e = dynamic_cast<ObjectExpression *>(&expr)) {
+		stack.push_back(std::move(e->keys));
+		stack.push_back(std::move(e->values));
+	} else if (auto e = dynamic_cast<LambdaExpression *>(&expr)) {
+		stack.push_back(std::move(e->body));
+	} else if (auto e = dynamic_cast<ImportExpression *>(&expr)) {
+		stack.push_back(std::move(e->path));
+		if (e->module) stack.push_back(std::move(e->module));
+	}
+}
+
+std::size_t destroy_all(std::vector<refcount_ptr<Expression const>> & stack) {
+	std::size_t n = 0;
+	while (!stack.empty()) {
+		auto e = stack.back().release_unique();
+		// If it wasn't the last reference, this just drops ours.
+		stack.pop_back();
+		if (!e) continue;
+		detach_children(*e, stack);
+		++n;
+	}
+	return n;
+}
+
+}
+
+std::size_t destroy(refcount_ptr<Expression const> expr) {
+	std::vector<refcount_ptr<Expression const>> stack;
+	stack.push_back(std::move(expr));
+	return destroy_all(stack);
+}
+
+Reclaimer::Reclaimer() {
+	thread_ = std::thread([this] { run(); });
+}
+
+Reclaimer::~Reclaimer() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void Reclaimer::retire(refcount_ptr<Expression const> expr) {
+	if (!expr) return;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		queue_.push_back(std::move(expr));
+		++retired_;
+	}
+	wake_.notify_one();
+}
+
+void Reclaimer::flush() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	auto target = retired_;
+	done_.wait(lock, [&] { return reclaimed_ >= target; });
+}
+
+std::size_t Reclaimer::destroyed() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return destroyed_;
+}
+
+void Reclaimer::run() {
+	std::vector<refcount_ptr<Expression const>> batch;
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		wake_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+		if (queue_.empty()) return;
+		// Take everything queued at once, and destroy it without holding
+		// the lock, so retire() never has to wait for that.
+		batch.swap(queue_);
+		auto n_trees = batch.size();
+		lock.unlock();
+		auto n = destroy_all(batch);
+		lock.lock();
+		reclaimed_ += n_trees;
+		destroyed_ += n;
+		done_.notify_all();
+	}
+}
+
+}
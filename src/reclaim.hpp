@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "expression.hpp"
+
+namespace conftaal {
+
+// Destroys the tree without recursion, with a stack on the heap, so even
+// the deepest trees can't overflow the call stack. Subtrees that are still
+// referenced elsewhere are left alone. Returns the number of expressions
+// destroyed.
+std::size_t destroy(refcount_ptr<Expression const>);
+
+// Destroys trees of expressions on a background thread, such as the
+// previous version of a configuration after loading a new one.
+//
+// Retiring a tree only queues it, so dropping even a very large tree takes
+// constant time. The thread takes all queued trees at once, and destroys
+// them with destroy().
+class Reclaimer {
+public:
+	Reclaimer();
+
+	Reclaimer(Reclaimer const &) = delete;
+	Reclaimer & operator=(Reclaimer const &) = delete;
+
+	// Destroys the trees that are still queued, and stops the thread.
+	~Reclaimer();
+
+	// Safe to call from multiple threads at once.
+	void retire(refcount_ptr<Expression const>);
+
+	// Waits until all trees retired so far are destroyed.
+	void flush();
+
+	// The number of expressions destroyed so far.
+	std::size_t destroyed() const;
+
+private:
+	void run();
+
+	mutable std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	std::vector<refcount_ptr<Expression const>> queue_;
+	std::size_t retired_ = 0;
+	std::size_t reclaimed_ = 0;
+	std::size_t destroyed_ = 0;
+	bool stopping_ = false;
+	std::thread thread_;
+};
+
+}
@@ -0,0 +1,108 @@
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expression.hpp"
+#include "resolve.hpp"
+
+namespace conftaal {
+
+namespace {
+
+class Resolver {
+public:
+	explicit Resolver(Bindings & bindings) : bindings_(bindings) {}
+
+	void push_scope(std::vector<std::string_view> const & names, LambdaExpression const * lambda = nullptr) {
+		scopes_.emplace_back();
+		auto & scope = scopes_.back();
+		scope.lambda = lambda;
+		scope.slots.reserve(names.size());
+		for (std::size_t i = 0; i < names.size(); ++i) scope.slots[names[i]] = i;
+	}
+
+	void push_scope(ListExpression const & keys) {
+		scopes_.emplace_back();
+		auto & scope = scopes_.back();
+		scope.slots.reserve(keys.elements.size());
+		for (std::size_t i = 0; i < keys.elements.size(); ++i) {
+			// The keys of an object are always string literals.
+			scope.slots[static_cast<StringLiteralExpression const &>(*keys.elements[i]).value()] = i;
+		}
+	}
+
+	void pop_scope() {
+		scopes_.pop_back();
+	}
+
+	void resolve(Expression const & expr) {
+		if (auto e = dynamic_cast<IdentifierExpression const *>(&expr)) {
+			auto slot = lookup(e->identifier, scopes_.size() - 1);
+			if (slot.resolved()) {
+				bindings_.slots[e] = slot;
+			} else {
+				bindings_.errors.emplace_back("undefined name `" + std::string(e->identifier) + "'", e->identifier);
+			}
+		} else if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
+			if (e->lhs) resolve(*e->lhs);
+			if (e->op != Operator::dot) resolve(*e->rhs);
+		} else if (auto e = dynamic_cast<ListExpression const *>(&expr)) {
+			for (auto const & element : e->elements) resolve(*element);
+		} else if (auto e = dynamic_cast<ObjectExpression const *>(&expr)) {
+			push_scope(*e->keys);
+			resolve(*e->values);
+			pop_scope();
+		} else if (auto e = dynamic_cast<LambdaExpression const *>(&expr)) {
+			push_scope(e->parameters, e);
+			resolve(*e->body);
+			pop_scope();
+		}
+	}
+
+private:
+	struct Scope {
+		std::unordered_map<std::string_view, std::uint32_t> slots;
+
+		// If this is the scope of a lambda, its body can't see the scopes
+		// around it. Names from there are added to the captures of the
+		// lambda, and slots after the parameters.
+		LambdaExpression const * lambda = nullptr;
+	};
+
+	// Looks up a name as seen from the scope with the given index.
+	ScopeSlot lookup(std::string_view name, std::size_t top) {
+		for (std::size_t i = top + 1; i-- > 0;) {
+			auto & scope = scopes_[i];
+			std::uint32_t depth = top - i;
+			auto slot = scope.slots.find(name);
+			if (slot != scope.slots.end()) return {depth, slot->second};
+			if (scope.lambda && i > 0) {
+				auto outer = lookup(name, i - 1);
+				if (!outer.resolved()) return outer;
+				auto & captures = bindings_.captures[scope.lambda];
+				std::uint32_t slot = scope.lambda->parameters.size() + captures.size();
+				captures.push_back(outer);
+				scope.slots.emplace(name, slot);
+				return {depth, slot};
+			}
+		}
+		return {};
+	}
+
+	Bindings & bindings_;
+	std::vector<Scope> scopes_;
+};
+
+}
+
+Bindings resolve(Expression const & root, std::vector<std::string_view> const & globals) {
+	Bindings bindings;
+	Resolver resolver(bindings);
+	resolver.push_scope(globals);
+	resolver.resolve(root);
+	return bindings;
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "error.hpp"
+#include "expression.hpp"
+
+namespace conftaal {
+
+// Where the value an identifier refers to lives: the slot of a scope,
+// counting scopes outwards from the innermost one.
+struct ScopeSlot {
+	static constexpr std::uint32_t unresolved = -1;
+
+	std::uint32_t depth = unresolved;
+	std::uint32_t slot = 0;
+
+	bool resolved() const { return depth != unresolved; }
+};
+
+// What resolve() found for a tree. Kept apart from the tree, as trees are
+// shared, also between threads.
+struct Bindings {
+	// For every identifier that is a reference.
+	std::unordered_map<IdentifierExpression const *, ScopeSlot> slots;
+
+	// The free variables used in the body of a lambda, as slots in the
+	// scopes around the lambda. The body is resolved against a single flat
+	// scope: the parameters, followed by these captures. Only for lambdas
+	// that capture anything.
+	std::unordered_map<LambdaExpression const *, std::vector<ScopeSlot>> captures;
+
+	// An error for every identifier that refers to nothing, pointing at
+	// that identifier.
+	std::vector<Error> errors;
+
+	// Unresolved if the identifier refers to nothing, or is not a reference,
+	// like the key after a `.'.
+	ScopeSlot slot(IdentifierExpression const & e) const {
+		auto i = slots.find(&e);
+		return i == slots.end() ? ScopeSlot() : i->second;
+	}
+
+	std::vector<ScopeSlot> const & captures_of(LambdaExpression const & e) const {
+		static std::vector<ScopeSlot> const none;
+		auto i = captures.find(&e);
+		return i == captures.end() ? none : i->second;
+	}
+};
+
+// Binds every identifier in the tree to the scope slot it refers to, so
+// evaluation never needs to look up a name.
+//
+// Every object is a scope, with a slot for each of its keys (in order; if
+// a key occurs twice, its last slot is used). The globals form the
+// outermost scope. An identifier refers to the innermost scope that
+// defines its name. The identifier after a `.' is a key of the object on
+// the left, not a reference, and is left unresolved.
+//
+// The body of a lambda only sees one flat scope, holding its parameters
+// followed by its captures. Every name the body uses from outside the
+// lambda is captured exactly once, and stored in its captures as seen from
+// the scope around the lambda (possibly a capture of an outer lambda).
+//
+// The results are keyed by node, so a subtree that occurs more than once
+// in the same tree should be in the same scope every time. The tree itself
+// is not modified, so resolving trees that share subtrees, or the same tree
+// on several threads, is fine.
+Bindings resolve(Expression const & root, std::vector<std::string_view> const & globals = {});
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <string_view>
+
+namespace conftaal {
+
+// A range in a source file, as offsets from the start of the file.
+//
+// Trees and errors refer to their source through string_views. Diagnostics
+// turn those into a SourceRange, to find the line and column of a location
+// without a string_tracker.
+struct SourceRange {
+	std::size_t offset = 0;
+	std::size_t size = 0;
+
+	// 'where' must be a part of 'source', or be empty.
+	// Like a ParseError's location, it can extend one past the end of
+	// the source, which is ignored.
+	static SourceRange of(std::string_view where, std::string_view source) {
+		if (where.data() == nullptr) return {};
+		assert(where.data() >= source.data() && where.data() <= source.data() + source.size());
+		std::size_t offset = where.data() - source.data();
+		std::size_t size = std::min(where.size(), source.size() - offset);
+		return {offset, size};
+	}
+
+	std::string_view in(std::string_view source) const {
+		return source.substr(offset, size);
+	}
+};
+
+// A one-based line and column, as printed in diagnostics.
+struct LineColumn {
+	std::size_t line;
+	std::size_t column;
+};
+
+// Finds the line and column of an offset by counting the lines before it.
+inline LineColumn locate(std::string_view source, std::size_t offset) {
+	auto before = source.substr(0, offset);
+	auto line_start = before.rfind('\n') + 1; // npos + 1 == 0
+	return {
+		std::size_t(std::count(before.begin(), before.end(), '\n')) + 1,
+		before.size() - line_start + 1
+	};
+}
+
+}
@@ -1,13 +1,37 @@
 #include <unistd.h>
 
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include <string_tracker.hpp>
 
+#include "batch.hpp"
+#include "bind.hpp"
+#include "diagnostics.hpp"
 #include "expression.hpp"
+#include "format.hpp"
+#include "incremental.hpp"
+#include "jit.hpp"
+#include "json.hpp"
+#include "mapped_file.hpp"
+#include "memory.hpp"
+#include "module.hpp"
+#include "overlay.hpp"
 #include "parse.hpp"
+#include "query.hpp"
+#include "reclaim.hpp"
+#include "resolve.hpp"
 #include "print_error.hpp"
 
 using string_pool::string_tracker;
@@ -47,56 +71,648 @@ char const * op_str(Operator op) {
 	return "???";
 }
 
-std::ostream & operator << (std::ostream & out, Expression const & expr) {
+// Prints the expression, with what resolve() found, if given.
+void print(std::ostream & out, Expression const & expr, Bindings const * bindings) {
 	if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
-		out << "(op:" << op_str(e->op) << ' ';
-		if (!e->is_unary()) {
-			out << *e->lhs << ' ';
+		// Left-nested chains without recursing, as they can be very long.
+		std::vector<OperatorExpression const *> chain{e};
+		while (auto lhs = chain.back()->is_unary() ? nullptr : dynamic_cast<OperatorExpression const *>(chain.back()->lhs.get())) {
+			chain.push_back(lhs);
+		}
+		for (auto o : chain) out << "(op:" << op_str(o->op) << ' ';
+		auto innermost = chain.back();
+		if (!innermost->is_unary()) {
+			print(out, *innermost->lhs, bindings);
+			out << ' ';
+		}
+		print(out, *innermost->rhs, bindings);
+		out << ')';
+		for (auto i = chain.rbegin() + 1; i != chain.rend(); ++i) {
+			out << ' ';
+			print(out, *(*i)->rhs, bindings);
+			out << ')';
 		}
-		out << *e->rhs << ')';
 	} else if (auto e = dynamic_cast<IdentifierExpression const *>(&expr)) {
 		out << "id:" << e->identifier;
+		auto slot = bindings ? bindings->slot(*e) : ScopeSlot();
+		if (slot.resolved()) out << '@' << slot.depth << ':' << slot.slot;
+	} else if (auto e = dynamic_cast<LambdaExpression const *>(&expr)) {
+		out << "(lambda";
+		for (auto p : e->parameters) out << ' ' << p;
+		if (bindings && !bindings->captures_of(*e).empty()) {
+			auto const & captures = bindings->captures_of(*e);
+			out << " captures=(";
+			for (auto const & c : captures) {
+				out << (&c == &captures.front() ? "@" : " @") << c.depth << ':' << c.slot;
+			}
+			out << ')';
+		}
+		out << " -> ";
+		print(out, *e->body, bindings);
+		out << ')';
+	} else if (auto e = dynamic_cast<ImportExpression const *>(&expr)) {
+		out << "(import " << std::quoted(std::string(e->path->value()));
+		if (e->module) {
+			out << " = ";
+			print(out, *e->module, bindings);
+		}
+		out << ')';
 	} else if (auto e = dynamic_cast<ObjectExpression const *>(&expr)) {
-		out << "(object keys=" << *e->keys << " values=" << *e->values << ')';
+		out << "(object keys=";
+		print(out, *e->keys, bindings);
+		out << " values=";
+		print(out, *e->values, bindings);
+		out << ')';
 	} else if (auto e = dynamic_cast<ListExpression const *>(&expr)) {
 		out << "(list";
 		for (auto const & v : e->elements) {
-			out << ' ' << *v;
+			out << ' ';
+			print(out, *v, bindings);
 		}
 		out << ')';
 	} else if (auto e = dynamic_cast<StringLiteralExpression const *>(&expr)) {
-		out << "str:" << std::quoted(std::string(e->value));
+		out << "str:" << std::quoted(std::string(e->value()));
 	} else if (auto e = dynamic_cast<IntegerLiteralExpression const *>(&expr)) {
 		out << "int:" << e->value;
 	} else if (auto e = dynamic_cast<DoubleLiteralExpression const *>(&expr)) {
 		out << "float:" << std::hexfloat << e->value;
+	} else if (auto e = dynamic_cast<ErrorExpression const *>(&expr)) {
+		out << "error:" << std::quoted(std::string(e->source));
 	}
+}
+
+std::ostream & operator << (std::ostream & out, Expression const & expr) {
+	print(out, expr, nullptr);
 	return out;
 }
 
+void collect_identifiers(Expression const & expr, std::vector<string_view> & names) {
+	if (auto e = dynamic_cast<IdentifierExpression const *>(&expr)) {
+		if (std::find(names.begin(), names.end(), e->identifier) == names.end()) names.push_back(e->identifier);
+	} else if (auto e = dynamic_cast<OperatorExpression const *>(&expr)) {
+		if (e->lhs) collect_identifiers(*e->lhs, names);
+		collect_identifiers(*e->rhs, names);
+	}
+}
+
+// Evaluates the expression for the given number of rows, in a batch, row
+// by row, and with compiled code. Identifiers starting with `f' are
+// floating point inputs, all others are integer inputs.
+void test_batch(Expression const & expr, std::size_t n_rows) {
+	std::vector<string_view> names;
+	collect_identifiers(expr, names);
+	BatchEvaluator::Inputs inputs;
+	std::vector<Column> columns(names.size());
+	for (std::size_t k = 0; k < names.size(); ++k) {
+		auto type = names[k][0] == 'f' ? NumericType::floating : NumericType::integer;
+		inputs.emplace_back(names[k], type);
+		columns[k].type = type;
+		for (std::size_t i = 0; i < n_rows; ++i) {
+			auto v = std::int64_t((i * (k + 2) + k) % 11) - 5;
+			if (type == NumericType::integer) columns[k].integers.push_back(v);
+			else columns[k].floats.push_back(v * 0.75);
+		}
+	}
+	BatchEvaluator evaluator(expr, inputs);
+	CompiledExpression compiled(expr, inputs);
+
+	std::vector<Column const *> column_ptrs;
+	for (auto const & c : columns) column_ptrs.push_back(&c);
+	std::vector<std::uint8_t> failed;
+	auto result = evaluator.evaluate(column_ptrs, &failed);
+
+	std::cout << std::defaultfloat;
+	for (std::size_t k = 0; k < names.size(); ++k) {
+		std::cout << names[k] << ':';
+		for (auto v : columns[k].integers) std::cout << ' ' << v;
+		for (auto v : columns[k].floats) std::cout << ' ' << v;
+		std::cout << '\n';
+	}
+	std::cout << (result.type == NumericType::integer ? "int:" : "float:");
+	for (std::size_t i = 0; i < n_rows; ++i) {
+		std::cout << ' ';
+		if (failed[i]) {
+			std::cout << '!';
+		} else if (result.type == NumericType::integer) {
+			std::cout << result.integers[i];
+		} else {
+			std::cout << result.floats[i];
+		}
+
+		std::vector<Column> row(names.size());
+		std::vector<Column const *> row_ptrs;
+		std::vector<std::int64_t> values;
+		for (std::size_t k = 0; k < names.size(); ++k) {
+			row[k].type = columns[k].type;
+			if (columns[k].type == NumericType::integer) {
+				row[k].integers = {columns[k].integers[i]};
+				values.push_back(columns[k].integers[i]);
+			} else {
+				row[k].floats = {columns[k].floats[i]};
+				values.push_back(to_bits(columns[k].floats[i]));
+			}
+			row_ptrs.push_back(&row[k]);
+		}
+		std::vector<std::uint8_t> row_failed;
+		auto row_result = evaluator.evaluate(row_ptrs, &row_failed);
+		bool same = row_failed[0] == failed[i] && (failed[i] || (result.type == NumericType::integer
+			? row_result.integers[0] == result.integers[i]
+			: row_result.floats[0] == result.floats[i] || (std::isnan(row_result.floats[0]) && std::isnan(result.floats[i]))));
+		if (!same) std::cout << "(inconsistent with row by row evaluation)";
+
+		for (bool native : {true, false}) {
+			std::uint8_t compiled_failed = 0;
+			auto v = native ? compiled.evaluate(values.data(), compiled_failed) : compiled.interpret(values.data(), compiled_failed);
+			bool ok = compiled_failed == failed[i] && (failed[i] || (result.type == NumericType::integer
+				? v == result.integers[i]
+				: from_bits(v) == result.floats[i] || (std::isnan(from_bits(v)) && std::isnan(result.floats[i]))));
+			if (!ok) std::cout << (native ? "(inconsistent with compiled code)" : "(inconsistent with tree walking)");
+		}
+	}
+	std::cout << std::endl;
+}
+
+std::string dump(Expression const & expr) {
+	std::ostringstream s;
+	s << expr;
+	return s.str();
+}
+
+// Prints the expression formatted both ways, and checks that parsing the
+// output results in the same expression, which formats the same again.
+// Returns false if it doesn't. If quiet, only prints the size of the output.
+bool test_format(Expression const & expr, ParseOptions const & options, bool quiet) {
+	bool ok = true;
+	for (bool compact : {false, true}) {
+		auto formatted = format(expr, FormatOptions{compact});
+		if (quiet) {
+			std::cout << "formatted " << (compact ? "compact" : "normal") << ": " << formatted.size() << " bytes" << std::endl;
+		} else {
+			std::cout << formatted << std::endl;
+		}
+		try {
+			auto reparsed = Parser(formatted, options).parse_expression();
+			if (!reparsed || dump(*reparsed) != dump(expr)) {
+				std::cout << "(parsed back differently)" << std::endl;
+				ok = false;
+			} else if (format(*reparsed, FormatOptions{compact}) != formatted) {
+				std::cout << "(formatted differently after parsing back)" << std::endl;
+				ok = false;
+			}
+		} catch (Error & e) {
+			std::cout << "(unable to parse back: " << e.what() << ")" << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// Layers the objects of the list on top of each other, and prints the view
+// after every layer. The views are only printed after building all of them,
+// to check that adding a layer leaves the view below intact.
+void test_overlay(Expression const & expr) {
+	auto list = dynamic_cast<ListExpression const *>(&expr);
+	if (!list) throw Error("expected a list of objects");
+	std::vector<Overlay> views;
+	Overlay view;
+	for (auto const & e : list->elements) {
+		auto object = dynamic_cast<ObjectExpression const *>(e.get());
+		if (!object) throw Error("expected an object");
+		view = view.layer(*object);
+		views.push_back(view);
+	}
+	for (auto const & v : views) {
+		std::cout << v.size() << ": " << *v.to_expression() << std::endl;
+	}
+}
+
+void print_field(IncrementalEvaluator const & evaluator, std::size_t f) {
+	auto const & v = evaluator.value(f);
+	std::cout << evaluator.name(f);
+	if (v.state == FieldValue::State::error) {
+		std::cout << ": error: " << v.error;
+	} else if (v.state == FieldValue::State::failed) {
+		std::cout << ": failed";
+	} else if (v.type == NumericType::integer) {
+		std::cout << " = " << v.bits;
+	} else {
+		std::cout << " = " << from_bits(v.bits);
+	}
+	std::cout << std::endl;
+}
+
+// Evaluates the first object of the list, and then applies the others as
+// changes, one at a time, printing the fields that changed.
+void test_incremental(Expression const & expr) {
+	auto list = dynamic_cast<ListExpression const *>(&expr);
+	if (!list || list->elements.empty()) throw Error("expected a list of objects");
+	auto object = [] (Expression const & e) -> ObjectExpression const & {
+		auto object = dynamic_cast<ObjectExpression const *>(&e);
+		if (!object) throw Error("expected an object");
+		return *object;
+	};
+	auto const & base = object(*list->elements[0]);
+	IncrementalEvaluator evaluator(base);
+	for (std::size_t f = 0; f < evaluator.size(); ++f) print_field(evaluator, f);
+	for (std::size_t i = 1; i < list->elements.size(); ++i) {
+		std::cout << "--" << std::endl;
+		try {
+			evaluator.set(object(*list->elements[i]));
+		} catch (Error & e) {
+			std::cout << "error: " << e.what() << std::endl;
+			continue;
+		}
+		auto changed = evaluator.update();
+		std::cout << "evaluated " << evaluator.evaluated() << " field(s)" << std::endl;
+		for (auto f : changed) print_field(evaluator, f);
+	}
+}
+
+struct BindLimits {
+	std::int8_t priority = 0;
+	std::uint16_t port = 0;
+	double ratio = 0;
+};
+
+struct BindService {
+	std::string name;
+	std::int64_t offset = 0;
+	double scale = 0;
+	std::vector<std::string> tags;
+	BindLimits limits;
+	std::vector<BindLimits> backends;
+};
+
+template<> struct ObjectBinding<BindLimits> {
+	static constexpr auto binding = conftaal::binding(
+		field("priority", &BindLimits::priority),
+		field("port", &BindLimits::port),
+		field("ratio", &BindLimits::ratio)
+	);
+};
+
+template<> struct ObjectBinding<BindService> {
+	static constexpr auto binding = conftaal::binding(
+		field("name", &BindService::name),
+		field("offset", &BindService::offset),
+		field("scale", &BindService::scale),
+		field("tags", &BindService::tags),
+		field("limits", &BindService::limits),
+		field("backends", &BindService::backends)
+	);
+};
+
+std::ostream & operator << (std::ostream & out, BindLimits const & l) {
+	return out << "{priority " << int(l.priority) << ", port " << l.port << ", ratio " << l.ratio << "}";
+}
+
+// Decodes the object into a BindService, and prints it.
+void test_bind(Expression const & expr) {
+	auto s = decode<BindService>(expr);
+	std::cout << "name: " << s.name << std::endl;
+	std::cout << "offset: " << s.offset << std::endl;
+	std::cout << "scale: " << s.scale << std::endl;
+	std::cout << "tags:";
+	for (auto const & t : s.tags) std::cout << " " << t;
+	std::cout << std::endl;
+	std::cout << "limits: " << s.limits << std::endl;
+	std::cout << "backends:";
+	for (auto const & b : s.backends) std::cout << " " << b;
+	std::cout << std::endl;
+}
+
+// The sizes of nodes and vectors depend on the platform, so only the
+// number of nodes and the size of decoded strings are printed.
+void print_usage(std::string_view name, MemoryUsage const & usage) {
+	std::cout << name << ": " << usage.node_count << " nodes, "
+		<< (usage.vectors ? "vectors, " : "no vectors, ") << usage.strings << " string bytes" << std::endl;
+	if (usage.nodes < usage.node_count * sizeof(Expression) || (usage.nodes == 0) != (usage.node_count == 0)) {
+		std::cout << "(" << usage.nodes << " node bytes for " << usage.node_count << " nodes)" << std::endl;
+	}
+}
+
+// Prints the metrics, with the platform dependent sizes of nodes and
+// vectors replaced by `_', after checking that the samples of each kind
+// add up to the total.
+void print_metrics(std::string const & metrics, MemoryUsage const & total) {
+	std::size_t nodes = 0, vectors = 0, strings = 0;
+	std::istringstream in(metrics);
+	for (std::string line; std::getline(in, line);) {
+		auto value_start = line.rfind(' ') + 1;
+		if (line[0] == '#' || value_start == 0) {
+			std::cout << line << '\n';
+			continue;
+		}
+		auto value = std::stoull(line.substr(value_start));
+		if (line.find("kind=\"strings\"") != std::string::npos) {
+			strings += value;
+			std::cout << line << '\n';
+			continue;
+		}
+		(line.find("kind=\"nodes\"") != std::string::npos ? nodes : vectors) += value;
+		std::cout << line.substr(0, value_start) << "_\n";
+	}
+	if (nodes != total.nodes || vectors != total.vectors || strings != total.strings) {
+		std::cout << "(samples do not add up to the total)" << std::endl;
+	}
+}
+
+// Prints the memory report of the object, and of an object with every key
+// twice, which shares everything but the root.
+void test_memory(Expression const & expr, string_view source) {
+	auto object = dynamic_cast<ObjectExpression const *>(&expr);
+	if (!object) throw Error("expected an object");
+	auto report = memory_report(*object, source);
+	print_usage("root", report.root);
+	for (auto const & [key, usage] : report.keys) print_usage(key, usage);
+	print_usage("shared", report.shared);
+	auto total = report.total();
+	auto usage = memory_usage(expr, source);
+	if (total.total() != usage.total() || total.node_count != usage.node_count) {
+		std::cout << "(inconsistent with memory_usage)" << std::endl;
+	}
+
+	auto twice = [] (ListExpression const & list) {
+		auto elements = list.elements;
+		elements.insert(elements.end(), list.elements.begin(), list.elements.end());
+		return refcount_ptr<ListExpression const>(std::make_unique<ListExpression>(std::move(elements)));
+	};
+	ObjectExpression doubled(twice(*object->keys), twice(*object->values));
+	auto doubled_report = memory_report(doubled, source);
+	for (auto const & [key, usage] : doubled_report.keys) {
+		if (usage.node_count) std::cout << "(`" << key << "' not shared)" << std::endl;
+	}
+	if (doubled_report.shared.total() != total.total() - report.root.total()) {
+		std::cout << "(shared part counted wrongly)" << std::endl;
+	}
+
+	std::string metrics;
+	write_metrics_header(metrics);
+	write_metrics(report, metrics, "tenant=\"test\"");
+	print_metrics(metrics, total);
+}
+
+// Parses the parts of the source ending in a `#---' line as separate files,
+// which are adjacent slices of the same buffer, and reports the errors in
+// all of them at once.
+void test_split(std::string_view file_name, string_view source, ParseOptions options, DiagnosticFormat format) {
+	options.recover = true;
+	std::vector<string_view> parts;
+	for (std::size_t start = 0, end; start < source.size(); start = end) {
+		end = source.find("#---\n", start);
+		end = end == string_view::npos ? source.size() : end + 5;
+		parts.push_back(source.substr(start, end - start));
+	}
+	DiagnosticSink sink;
+	for (std::size_t i = 0; i < parts.size(); ++i) {
+		sink.add_source(std::string(file_name) + '#' + std::to_string(i + 1), parts[i]);
+	}
+	for (auto part : parts) {
+		try {
+			Parser parser(part, options);
+			auto expr = parser.parse_expression();
+			for (auto const & e : parser.errors()) sink.add(e);
+			if (!expr) throw ParseError("missing expression", part);
+		} catch (Error & e) {
+			sink.add(e);
+		}
+	}
+	std::string out;
+	sink.render(out, format, isatty(2));
+	std::clog << out;
+}
+
 }
 
 int main(int argc, char * * argv) {
-	if (argc != 2) {
-		std::clog << "Usage: " << argv[0] << " file" << std::endl;
+	conftaal::ParseOptions options;
+	bool untracked = false;
+	bool resolve = false;
+	std::optional<conftaal::DiagnosticFormat> diagnostics;
+	std::vector<std::string_view> queries;
+	std::size_t batch_rows = 0;
+	bool imports = false;
+	bool overlay = false;
+	bool format = false;
+	bool json = false;
+	bool reclaim = false;
+	bool incremental = false;
+	bool memory = false;
+	bool bind = false;
+	bool split = false;
+	bool quiet = false;
+
+	// Returns the value of a `--name=value' argument, if arg is one.
+	auto option_value = [] (std::string_view arg, std::string_view name) -> std::optional<std::size_t> {
+		if (arg.substr(0, name.size()) != name || arg.substr(name.size(), 1) != "=") return std::nullopt;
+		return std::stoull(std::string(arg.substr(name.size() + 1)));
+	};
+
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+		std::string_view arg = argv[argi];
+		if (auto v = option_value(arg, "--max-source-bytes")) {
+			options.limits.max_source_bytes = *v;
+		} else if (auto v = option_value(arg, "--max-nodes")) {
+			options.limits.max_nodes = *v;
+		} else if (auto v = option_value(arg, "--max-memory")) {
+			options.limits.max_allocated_bytes = *v;
+		} else if (auto v = option_value(arg, "--max-depth")) {
+			options.limits.max_depth = *v;
+		} else if (auto v = option_value(arg, "--batch")) {
+			batch_rows = *v;
+		} else if (auto v = option_value(arg, "--max-time-ms")) {
+			options.limits.max_time = std::chrono::milliseconds(*v);
+		} else if (arg.substr(0, 8) == "--query=") {
+			queries.push_back(arg.substr(8));
+		} else if (arg == "--recover") {
+			options.recover = true;
+		} else if (arg == "--lazy-strings") {
+			options.lazy_string_literals = true;
+		} else if (arg == "--diagnostics=text") {
+			diagnostics = conftaal::DiagnosticFormat::text;
+		} else if (arg == "--diagnostics=json") {
+			diagnostics = conftaal::DiagnosticFormat::json;
+		} else if (arg == "--diagnostics=sarif") {
+			diagnostics = conftaal::DiagnosticFormat::sarif;
+		} else if (arg == "--overlay") {
+			overlay = true;
+		} else if (arg == "--format") {
+			format = true;
+		} else if (arg == "--quiet") {
+			quiet = true;
+		} else if (arg == "--incremental") {
+			incremental = true;
+		} else if (arg == "--memory") {
+			memory = true;
+		} else if (arg == "--bind") {
+			bind = true;
+		} else if (arg == "--reclaim") {
+			reclaim = true;
+		} else if (arg == "--imports") {
+			imports = true;
+		} else if (arg == "--resolve") {
+			resolve = true;
+		} else if (arg == "--untracked") {
+			untracked = true;
+		} else if (arg == "--split") {
+			split = true;
+			untracked = true;
+		} else if (arg == "--json") {
+			// JSON is always parsed without a string_tracker.
+			json = true;
+			untracked = true;
+		} else {
+			break;
+		}
+	}
+
+	if (argc - argi != 1) {
+		std::clog << "Usage: " << argv[0] << " [--lazy-strings] [--recover] [--untracked] [--json] [--imports] [--overlay] [--format [--quiet]] [--incremental] [--memory] [--bind] [--reclaim] [--resolve] [--split] [--diagnostics={text,json,sarif}] [--query=path]... [--batch=rows] [--max-{source-bytes,nodes,memory,depth,time-ms}=N] file" << std::endl;
 		return 1;
 	}
 
-	string_tracker tracker;
+	if (imports) {
+		// Loads the file twice, to check that nothing is parsed again.
+		conftaal::ModuleLoader modules(options);
+		try {
+			auto expr = modules.load(argv[argi]);
+			std::cout << *expr << std::endl;
+			auto count = modules.parse_count();
+			if (modules.load(argv[argi]) != expr || modules.parse_count() != count) {
+				std::cout << "(parsed again although unchanged)" << std::endl;
+			}
+			std::cout << "parsed " << count << " file(s)" << std::endl;
+		} catch (conftaal::Error & e) {
+			conftaal::DiagnosticSink sink;
+			modules.add_sources(sink);
+			sink.add(e);
+			std::string out;
+			sink.render(out, diagnostics.value_or(conftaal::DiagnosticFormat::text), isatty(2));
+			std::clog << out;
+		}
+		return 0;
+	}
 
-	auto src = tracker.add_file(argv[1]);
+	conftaal::SourceLoader loader;
+	string_tracker & tracker = loader.tracker();
+
+	std::optional<conftaal::MappedFile> file;
+	std::string contents;
+	std::optional<std::string_view> src;
+
+	if (untracked) {
+		file = conftaal::MappedFile::open(argv[argi]);
+		if (file) {
+			src = file->contents();
+		} else if (std::ifstream in{argv[argi], std::ios::binary}) {
+			contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			src = contents;
+		}
+	} else {
+		src = loader.add_file(argv[argi]);
+	}
 
 	if (!src) {
 		std::cerr << "Unable to open file." << std::endl;
 		return 1;
 	}
 
+	if (split) {
+		conftaal::test_split(argv[argi], *src, options, diagnostics.value_or(conftaal::DiagnosticFormat::text));
+		return 0;
+	}
+
+	// Prints all errors, as a single document for --diagnostics.
+	auto report = [&] (auto const & errors) {
+		if (errors.empty()) return;
+		if (diagnostics) {
+			conftaal::DiagnosticSink sink(&tracker);
+			sink.add_source(argv[argi], *src);
+			for (auto const & e : errors) sink.add(e);
+			std::string out;
+			sink.render(out, *diagnostics, isatty(2));
+			std::clog << out;
+		} else {
+			for (auto const & e : errors) {
+				if (untracked) {
+					conftaal::print_error(e, argv[argi], *src, isatty(2));
+				} else {
+					conftaal::print_error(e, tracker, isatty(2));
+				}
+			}
+		}
+	};
+
 	try {
-		conftaal::Parser parser(tracker, *src);
-		auto expr = parser.parse_expression();
+		std::unique_ptr<conftaal::Expression> expr;
+		if (json) {
+			expr = conftaal::parse_json(*src, options);
+		} else {
+			auto parser = untracked
+				? conftaal::Parser(*src, options)
+				: conftaal::Parser(tracker, *src, options);
+			expr = parser.parse_expression();
+			report(parser.errors());
+		}
 		if (!expr) throw conftaal::ParseError("missing expression", *src);
-		std::cout << *expr << std::endl;
-	} catch (conftaal::ParseError & e) {
-		conftaal::print_error(e, tracker, isatty(2));
+		std::optional<conftaal::Bindings> bindings;
+		if (resolve) {
+			bindings = conftaal::resolve(*expr);
+			for (auto const & error : bindings->errors) conftaal::print_error(error, tracker, isatty(2));
+			if (!bindings->errors.empty()) return 0;
+		}
+		if (batch_rows) {
+			conftaal::test_batch(*expr, batch_rows);
+		} else if (overlay) {
+			conftaal::test_overlay(*expr);
+		} else if (format) {
+			if (!conftaal::test_format(*expr, options, quiet)) return 1;
+		} else if (incremental) {
+			conftaal::test_incremental(*expr);
+		} else if (bind) {
+			conftaal::test_bind(*expr);
+		} else if (memory) {
+			conftaal::test_memory(*expr, *src);
+		} else if (reclaim) {
+			// Without printing, as that recurses through the tree.
+			conftaal::Reclaimer reclaimer;
+			reclaimer.retire(std::move(expr));
+			reclaimer.flush();
+			std::cout << "destroyed " << reclaimer.destroyed() << " expressions" << std::endl;
+		} else if (queries.empty()) {
+			conftaal::print(std::cout, *expr, bindings ? &*bindings : nullptr);
+			std::cout << std::endl;
+		} else {
+			std::vector<conftaal::Path> paths;
+			bool valid = true;
+			for (auto query : queries) {
+				// Copied, so errors must point into the query itself.
+				std::string copy(query);
+				try {
+					paths.emplace_back(copy);
+				} catch (conftaal::ParseError & e) {
+					conftaal::print_error(e, "--query", copy, isatty(2));
+					valid = false;
+				}
+			}
+			if (!valid) return 0;
+			auto batch = conftaal::resolve_all(*expr, paths);
+			for (std::size_t i = 0; i < paths.size(); ++i) {
+				conftaal::AccessPlan plan(paths[i], *expr);
+				auto result = plan.resolve(*expr);
+				std::cout << paths[i].source() << ": ";
+				if (result) {
+					std::cout << *result << std::endl;
+				} else {
+					std::cout << "not found" << std::endl;
+				}
+				if (result != paths[i].resolve(*expr) || result != batch[i]) {
+					std::cout << "  (inconsistent with Path::resolve or resolve_all)" << std::endl;
+				}
+			}
+		}
+	} catch (conftaal::Error & e) {
+		report(std::vector<conftaal::Error>{e});
 	}
 }
@@ -0,0 +1,67 @@
+#include <cstddef>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "utf8.hpp"
+
+namespace conftaal {
+
+namespace {
+
+// The length of the valid multi-byte sequence at the start of s, or 0.
+std::size_t sequence_length(unsigned char const * s, std::size_t size) {
+	auto continuation = [&] (std::size_t i, unsigned char min = 0x80, unsigned char max = 0xBF) {
+		return i < size && s[i] >= min && s[i] <= max;
+	};
+	unsigned char lead = s[0];
+	if (lead >= 0xC2 && lead <= 0xDF) {
+		return continuation(1) ? 2 : 0;
+	} else if (lead >= 0xE0 && lead <= 0xEF) {
+		// No overlong encodings (E0) or surrogates (ED).
+		unsigned char min = lead == 0xE0 ? 0xA0 : 0x80;
+		unsigned char max = lead == 0xED ? 0x9F : 0xBF;
+		return continuation(1, min, max) && continuation(2) ? 3 : 0;
+	} else if (lead >= 0xF0 && lead <= 0xF4) {
+		// No overlong encodings (F0) or codepoints above U+10FFFF (F4).
+		unsigned char min = lead == 0xF0 ? 0x90 : 0x80;
+		unsigned char max = lead == 0xF4 ? 0x8F : 0xBF;
+		return continuation(1, min, max) && continuation(2) && continuation(3) ? 4 : 0;
+	}
+	return 0;
+}
+
+}
+
+std::size_t find_invalid_utf8(std::string_view source) {
+	auto s = reinterpret_cast<unsigned char const *>(source.data());
+	std::size_t const size = source.size();
+	std::size_t i = 0;
+	while (i < size) {
+#ifdef __SSE2__
+		// Skip over ASCII 16 bytes at a time: the sign bits of the bytes are
+		// exactly the non-ASCII ones.
+		while (i + 16 <= size) {
+			int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i)));
+			if (mask) {
+				i += __builtin_ctz(mask);
+				break;
+			}
+			i += 16;
+		}
+		if (i == size) break;
+#endif
+		if (s[i] < 0x80) {
+			++i;
+		} else if (auto n = sequence_length(s + i, size - i)) {
+			i += n;
+		} else {
+			return i;
+		}
+	}
+	return std::string_view::npos;
+}
+
+}
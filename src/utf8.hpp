@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace conftaal {
+
+// The offset of the first byte that does not start a valid UTF-8 sequence,
+// or std::string_view::npos if the whole string is valid UTF-8.
+//
+// Overlong encodings, surrogates and codepoints above U+10FFFF are invalid.
+std::size_t find_invalid_utf8(std::string_view);
+
+inline bool is_valid_utf8(std::string_view s) {
+	return find_invalid_utf8(s) == std::string_view::npos;
+}
+
+}